@@ -0,0 +1,160 @@
+#!/usr/bin/python3
+
+# Summarizes a heap snapshot, that was written by heap_snapshot(path) or --heap-snapshot-on-exit=<path>.
+# Prints the size of the objects of every type and the objects, that retain the most memory.
+# The retained size of an object is the memory, that would be freed, if the object became unreachable.
+#
+# Usage: heap_summary.py <snapshot> [number of dominators to list (default 20)]
+
+import sys
+from collections import defaultdict
+
+ROOT = 0
+
+
+def read_snapshot(path):
+    # node 0 is a virtual root, which references every real root
+    ids = ['']
+    types = ['(roots)']
+    sizes = [0]
+    previews = ['']
+    edges = [[]]
+    index = {}
+    pending_edges = []
+
+    with open(path, encoding='utf-8', errors='replace') as file:
+        header = file.readline().split()
+
+        if header != ['crispy-heap-snapshot', '1']:
+            sys.exit('{} is not a heap snapshot'.format(path))
+
+        for line in file:
+            line = line.rstrip('\n')
+
+            if line.startswith('N '):
+                parts = line.split(' ', 4)
+                index[parts[1]] = len(types)
+                ids.append(parts[1])
+                types.append(parts[2])
+                sizes.append(int(parts[3]))
+                previews.append(parts[4] if len(parts) > 4 else '')
+                edges.append([])
+            elif line.startswith('E '):
+                _, source, target = line.split()
+                pending_edges.append((source, target))
+            elif line.startswith('R '):
+                pending_edges.append((None, line.split()[1]))
+
+    # nodes can be referenced before they are written
+    for source, target in pending_edges:
+        edges[ROOT if source is None else index[source]].append(index[target])
+
+    return ids, types, sizes, previews, edges
+
+
+def reverse_postorder(edges):
+    order = []
+    visited = [False] * len(edges)
+    visited[ROOT] = True
+    stack = [(ROOT, iter(edges[ROOT]))]
+
+    while stack:
+        node, children = stack[-1]
+        child = next(children, None)
+
+        if child is None:
+            stack.pop()
+            order.append(node)
+        elif not visited[child]:
+            visited[child] = True
+            stack.append((child, iter(edges[child])))
+
+    order.reverse()
+    return order
+
+
+def dominators(edges, order):
+    # "A Simple, Fast Dominance Algorithm" by Cooper, Harvey and Kennedy
+    position = [-1] * len(edges)
+    for i, node in enumerate(order):
+        position[node] = i
+
+    predecessors = [[] for _ in edges]
+    for node in order:
+        for child in edges[node]:
+            predecessors[child].append(node)
+
+    idom = [None] * len(edges)
+    idom[ROOT] = ROOT
+
+    def intersect(a, b):
+        while a != b:
+            while position[a] > position[b]:
+                a = idom[a]
+            while position[b] > position[a]:
+                b = idom[b]
+        return a
+
+    changed = True
+    while changed:
+        changed = False
+
+        for node in order[1:]:
+            new_idom = None
+
+            for predecessor in predecessors[node]:
+                if idom[predecessor] is not None:
+                    new_idom = predecessor if new_idom is None else intersect(predecessor, new_idom)
+
+            if idom[node] != new_idom:
+                idom[node] = new_idom
+                changed = True
+
+    return idom
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit('Usage: heap_summary.py <snapshot> [number of dominators]')
+
+    top = int(sys.argv[2]) if len(sys.argv) > 2 else 20
+    ids, types, sizes, previews, edges = read_snapshot(sys.argv[1])
+    order = reverse_postorder(edges)
+    idom = dominators(edges, order)
+
+    retained = list(sizes)
+    dominated = [1] * len(sizes)
+    for node in reversed(order[1:]):
+        retained[idom[node]] += retained[node]
+        dominated[idom[node]] += dominated[node]
+
+    count = defaultdict(int)
+    shallow = defaultdict(int)
+    retained_by_type = defaultdict(int)
+
+    for node in order[1:]:
+        count[types[node]] += 1
+        shallow[types[node]] += sizes[node]
+
+        # objects dominated by an object of the same type are already included in its retained size
+        if types[idom[node]] != types[node]:
+            retained_by_type[types[node]] += retained[node]
+
+    print('{} objects, {} bytes'.format(len(order) - 1, retained[ROOT]))
+    print()
+    print('{:<12} {:>10} {:>14} {:>14}'.format('type', 'objects', 'shallow bytes', 'retained bytes'))
+
+    for name in sorted(count, key=lambda t: retained_by_type[t], reverse=True):
+        print('{:<12} {:>10} {:>14} {:>14}'.format(name, count[name], shallow[name], retained_by_type[name]))
+
+    print()
+    print('Largest dominators:')
+    print('{:<14} {:<12} {:>14} {:>10}  {}'.format('id', 'type', 'retained bytes', 'objects', 'preview'))
+
+    for node in sorted(order[1:], key=lambda n: retained[n], reverse=True)[:top]:
+        print('{:<14} {:<12} {:>14} {:>10}  {}'.format(ids[node], types[node], retained[node], dominated[node],
+                                                       previews[node]))
+
+
+if __name__ == '__main__':
+    main()
@@ -3,58 +3,122 @@
 import sys
 import subprocess
 import os
+import re
+import tempfile
 from pathlib import Path
 
+HEAP_SUMMARY = str(Path(__file__).absolute().parent.parent.parent / 'etc' / 'heap_summary.py')
+
 num_errors = 0
 
 
-def execute(executable, test_dir, result_dir, input_dir):
+def check_heap_snapshot(name, path):
+    # every object has to be reachable, so the summarizer has to find all of them
     global num_errors
 
-    for file_name in os.listdir(test_dir):
-        result_path = Path(result_dir + '/' + file_name[:-4].replace('test', 'expected'))
-        input_path = Path(input_dir + '/' + file_name[:-4].replace('test', 'input'))
+    with path.open(encoding='utf-8', errors='replace') as snapshot:
+        lines = snapshot.read().split('\n')
+
+    kinds = [line[:2] for line in lines[1:] if line != '']
+    objects = kinds.count('N ')
+
+    if lines[0] != 'crispy-heap-snapshot 1' or objects == 0 or kinds.count('E ') == 0 or kinds.count('R ') == 0 \
+            or len(kinds) != objects + kinds.count('E ') + kinds.count('R '):
+        print('[{}]: {} is not a valid heap snapshot'.format(name, path.name))
+        num_errors += 1
+        return
+
+    summary = subprocess.run([sys.executable, HEAP_SUMMARY, str(path), '1'], stdout=subprocess.PIPE,
+                             stderr=subprocess.STDOUT)
+    first_line = summary.stdout.decode('utf-8').split('\n')[0]
+    match = re.match(r'^(\d+) objects, \d+ bytes$', first_line)
+
+    if summary.returncode != 0 or match is None or int(match.group(1)) != objects:
+        print('[{}]: Expected a summary of {} objects for {}, but got {}'.format(name, objects, path.name, first_line))
+        num_errors += 1
+
+
+def read_options(options_dir, file_name):
+    # every line of an options file is one set of command line options, the test is run once with each of them
+    if options_dir is None:
+        return [[]]
+
+    options_path = Path(options_dir + '/' + file_name[:-4].replace('test', 'options'))
+
+    if not options_path.is_file():
+        return [[]]
+
+    with options_path.open() as options_file:
+        return [line.split() for line in options_file.read().split('\n')]
 
-        if not result_path.is_file():
-            print("Warning: {} has no result file".format(file_name))
-            continue
 
-        stdin = None
-        if input_path.is_file():
-            stdin = input_path.open()
+def execute_with(executable, options, test_dir, result_dir, input_dir, file_name):
+    global num_errors
 
-        result_file = result_path.open()
-        if stdin is None:
-            proc = subprocess.Popen([executable, test_dir + '/' + file_name], stdout=subprocess.PIPE)
-        else:
-            proc = subprocess.Popen([executable, test_dir + '/' + file_name], stdout=subprocess.PIPE, stdin=stdin)
+    result_path = Path(result_dir + '/' + file_name[:-4].replace('test', 'expected'))
+    input_path = Path(input_dir + '/' + file_name[:-4].replace('test', 'input'))
+    name = ' '.join([file_name] + options)
 
-        line = proc.stdout.readline().decode('utf-8').rstrip()
-        while line != '':
-            expected = result_file.readline().rstrip()
+    stdin = None
+    if input_path.is_file():
+        stdin = input_path.open()
 
-            if str(line) != str(expected):
-                print('[{}]: Expected {}, but got {}'.format(file_name, expected, line))
-                num_errors += 1
+    # files, that the test writes, end up in its own working directory
+    work_dir = tempfile.TemporaryDirectory()
 
-            line = proc.stdout.readline().decode('utf-8').rstrip()
+    result_file = result_path.open()
+    if stdin is None:
+        proc = subprocess.Popen([executable] + options + [test_dir + '/' + file_name], stdout=subprocess.PIPE,
+                                cwd=work_dir.name)
+    else:
+        proc = subprocess.Popen([executable] + options + [test_dir + '/' + file_name], stdout=subprocess.PIPE,
+                                stdin=stdin, cwd=work_dir.name)
 
+    # error messages contain the path of the test, which depends on where the repository is located
+    line = proc.stdout.readline().decode('utf-8').rstrip().replace(test_dir + '/', '')
+    while line != '':
         expected = result_file.readline().rstrip()
-        if expected != '':
-            print('[{}]: Error, did not print {}'.format(file_name, expected))
+
+        if str(line) != str(expected):
+            print('[{}]: Expected {}, but got {}'.format(name, expected, line))
             num_errors += 1
 
-        result_file.close()
+        line = proc.stdout.readline().decode('utf-8').rstrip().replace(test_dir + '/', '')
+
+    expected = result_file.readline().rstrip()
+    if expected != '':
+        print('[{}]: Error, did not print {}'.format(name, expected))
+        num_errors += 1
+
+    result_file.close()
+    proc.wait()
+
+    for snapshot in sorted(Path(work_dir.name).glob('*.heap')):
+        check_heap_snapshot(name, snapshot)
+
+    work_dir.cleanup()
+
+    if stdin is not None:
+        stdin.close()
+
+
+def execute(executable, test_dir, result_dir, input_dir, options_dir):
+    for file_name in os.listdir(test_dir):
+        result_path = Path(result_dir + '/' + file_name[:-4].replace('test', 'expected'))
+
+        if not result_path.is_file():
+            print("Warning: {} has no result file".format(file_name))
+            continue
 
-        if stdin is not None:
-            stdin.close()
+        for options in read_options(options_dir, file_name):
+            execute_with(executable, options, test_dir, result_dir, input_dir, file_name)
 
 
 def main():
     help_text = '''Usage: test_runner.py [Path to executable] [Path to test directory] [Path to expected result 
-    directory] [Path to input directory] '''
+    directory] [Path to input directory] [Optional path to options directory] '''
 
-    if len(sys.argv) != 5:
+    if len(sys.argv) != 5 and len(sys.argv) != 6:
         print(help_text)
         return
 
@@ -62,8 +126,9 @@ def main():
     test_dir = str(Path(sys.argv[2]).absolute())
     result_dir = str(Path(sys.argv[3]).absolute())
     input_dir = str(Path(sys.argv[4]).absolute())
+    options_dir = str(Path(sys.argv[5]).absolute()) if len(sys.argv) == 6 else None
 
-    execute(executable, test_dir, result_dir, input_dir)
+    execute(executable, test_dir, result_dir, input_dir, options_dir)
 
     if num_errors == 0:
         print('All tests were successful')
@@ -11,6 +11,7 @@
 
 #include "../vm/vm.h"
 #include "../vm/memory.h"
+#include "../vm/snapshot.h"
 #include "../util/ioutil.h"
 
 typedef struct {
@@ -43,7 +44,38 @@ void write_line(LineArray *line_array, char *line) {
     line_array->lines[line_array->count++] = line;
 }
 
-static void repl(Vm *vm, LineArray *lines) {
+void vm_init_with_options(Vm *vm, bool interactive, RunOptions *options) {
+    vm_init(vm, interactive);
+    vm->incremental_gc = options->incremental_gc;
+    vm->gc_slice_budget = options->gc_slice_budget;
+    vm->gc_threads = options->gc_threads;
+    vm->background_sweep = options->background_sweep;
+    vm->compacting_gc = options->compacting_gc;
+    set_heap_limits(vm, options->heap_growth, options->min_heap, options->max_heap);
+    set_heap_limit(vm, options->heap_limit);
+}
+
+void report_on_exit(Vm *vm, RunOptions *options) {
+    if (options->print_max_pause) {
+        fprintf(stderr, "Max gc pause: %.3f ms\n", vm->stats.max_pause / 1e6);
+    }
+
+    if (options->print_gc_stats) {
+        print_gc_stats(vm);
+    }
+
+    if (options->heap_snapshot != NULL && write_heap_snapshot(vm, options->heap_snapshot) < 0) {
+        fprintf(stderr, "Could not write the heap snapshot to '%s'\n", options->heap_snapshot);
+    }
+}
+
+/**
+ * Reads and interprets a single line.
+ * @param vm the current vm.
+ * @param lines the previous lines, which have to stay alive as long as the vm.
+ * @return false if the end of the input was reached.
+ */
+static bool repl(Vm *vm, LineArray *lines) {
     printf(">>> ");
 
     char *line;
@@ -51,22 +83,25 @@ static void repl(Vm *vm, LineArray *lines) {
 
     if (result < 0) {
         fprintf(stderr, "Bye.\n");
-        exit(0);
+        return false;
     }
 
     interpret_interactive(vm, line);
 
     write_line(lines, line);
+    return true;
 }
 
-void run_repl() {
+void run_repl(RunOptions *options) {
     Vm vm;
-    vm_init(&vm, true);
+    vm_init_with_options(&vm, true, options);
 
     LineArray lines;
     init_line_array(&lines);
 
-    while (true) {
-        repl(&vm, &lines);
+    while (repl(&vm, &lines)) {
     }
+
+    report_on_exit(&vm, options);
+    exit(0);
 }
@@ -6,6 +6,46 @@
 #ifndef CRISPY_CLI_H
 #define CRISPY_CLI_H
 
-void run_repl();
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "../vm/vm.h"
+
+typedef struct {
+    bool incremental_gc;
+    uint64_t gc_slice_budget;
+    bool print_max_pause;
+    bool print_gc_stats;
+    const char *heap_snapshot;
+    double heap_growth;
+    size_t min_heap;
+    size_t max_heap;
+    size_t heap_limit;
+    uint32_t gc_threads;
+    bool background_sweep;
+    bool compacting_gc;
+} RunOptions;
+
+/**
+ * Initializes a vm and applies the gc options to it.
+ * @param vm the vm.
+ * @param interactive whether the vm is used by the repl.
+ * @param options the command line options.
+ */
+void vm_init_with_options(Vm *vm, bool interactive, RunOptions *options);
+
+/**
+ * Prints the gc statistics and writes the heap snapshot, if the options request them.
+ * @param vm the vm, which finished running.
+ * @param options the command line options.
+ */
+void report_on_exit(Vm *vm, RunOptions *options);
+
+/**
+ * Runs the interactive interpreter until the end of stdin is reached.
+ * @param options the command line options.
+ */
+void run_repl(RunOptions *options);
 
 #endif //CRISPY_CLI_H
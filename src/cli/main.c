@@ -11,15 +11,190 @@
 #include "../include/crispy.h"
 #include "cli.h"
 
-static void run_file(const char *file_name);
+static void run_file(const char *file_name, RunOptions *options);
+
+static void usage() {
+    fprintf(stderr, "Usage: crispy [options] [file]\n"
+                    "  --incremental-gc         mark the heap in small slices instead of stopping the program\n"
+                    "  --gc-slice-budget=<n>    number of objects processed per slice (default %d)\n"
+                    "  --gc-max-pause           print the longest gc pause to stderr on exit\n"
+                    "  --gc-stats               print the gc statistics to stderr on exit\n"
+                    "  --heap-snapshot-on-exit=<path>\n"
+                    "                           write the reachable objects into a file on exit (see etc/heap_summary.py)\n"
+                    "  --background-sweep       free unreachable objects on a separate thread\n"
+                    "  --compact-gc             move objects out of mostly empty memory blocks after full collections\n"
+                    "  --gc-threads=<n>         number of threads, that mark the heap in full collections (default %d)\n"
+                    "  --heap-growth=<f>        factor, by which the heap may grow between full collections (default %.1f)\n"
+                    "  --min-heap=<size>        heap size of the first full collection (default %d)\n"
+                    "  --max-heap=<size>        upper bound for the gc threshold, 0 means none (default %d)\n"
+                    "  --heap-limit=<size>      stop with an error, if the heap grows beyond this, 0 means none (default %d)\n"
+                    "Sizes are given in bytes and may end with K, M or G.\n"
+                    "The environment variables CRISPY_GC_THREADS, CRISPY_HEAP_GROWTH, CRISPY_MIN_HEAP,\n"
+                    "CRISPY_MAX_HEAP and CRISPY_HEAP_LIMIT set the defaults for the corresponding options.\n",
+            GC_SLICE_BUDGET, GC_THREADS, HEAP_GROWTH, MIN_HEAP, MAX_HEAP, HEAP_LIMIT);
+    exit(1);
+}
+
+/**
+ * Parses a size in bytes with an optional K, M or G suffix.
+ * @param string the string.
+ * @param size will be set to the parsed size if successful.
+ * @return true if successful else false.
+ */
+static bool parse_size(const char *string, size_t *size) {
+    char *end;
+    unsigned long long value = strtoull(string, &end, 10);
+
+    if (end == string) {
+        return false;
+    }
+
+    switch (*end) {
+        case 'K':
+            value *= 1024;
+            ++end;
+            break;
+        case 'M':
+            value *= 1024 * 1024;
+            ++end;
+            break;
+        case 'G':
+            value *= 1024 * 1024 * 1024;
+            ++end;
+            break;
+        default:
+            break;
+    }
+
+    *size = (size_t) value;
+    return *end == '\0';
+}
+
+/**
+ * Parses a number of gc threads, which has to be at least 1.
+ * @param string the string.
+ * @param threads will be set to the parsed number if successful.
+ * @return true if successful else false.
+ */
+static bool parse_threads(const char *string, uint32_t *threads) {
+    char *end;
+    unsigned long value = strtoul(string, &end, 10);
+    *threads = (uint32_t) value;
+
+    return end != string && *end == '\0' && value >= 1 && value <= GC_MAX_THREADS;
+}
+
+/**
+ * Parses a heap growth factor, which has to be greater than 1.
+ * @param string the string.
+ * @param growth will be set to the parsed factor if successful.
+ * @return true if successful else false.
+ */
+static bool parse_growth(const char *string, double *growth) {
+    char *end;
+    *growth = strtod(string, &end);
+
+    return end != string && *end == '\0' && *growth > 1.0;
+}
+
+static void read_environment(RunOptions *options) {
+    const char *growth = getenv("CRISPY_HEAP_GROWTH");
+    const char *min_heap = getenv("CRISPY_MIN_HEAP");
+    const char *max_heap = getenv("CRISPY_MAX_HEAP");
+    const char *heap_limit = getenv("CRISPY_HEAP_LIMIT");
+    const char *threads = getenv("CRISPY_GC_THREADS");
+
+    if (threads != NULL && !parse_threads(threads, &options->gc_threads)) {
+        fprintf(stderr, "Invalid value for CRISPY_GC_THREADS: '%s'\n", threads);
+        exit(1);
+    }
+
+    if (growth != NULL && !parse_growth(growth, &options->heap_growth)) {
+        fprintf(stderr, "Invalid value for CRISPY_HEAP_GROWTH: '%s'\n", growth);
+        exit(1);
+    }
+
+    if (min_heap != NULL && !parse_size(min_heap, &options->min_heap)) {
+        fprintf(stderr, "Invalid value for CRISPY_MIN_HEAP: '%s'\n", min_heap);
+        exit(1);
+    }
+
+    if (max_heap != NULL && !parse_size(max_heap, &options->max_heap)) {
+        fprintf(stderr, "Invalid value for CRISPY_MAX_HEAP: '%s'\n", max_heap);
+        exit(1);
+    }
+
+    if (heap_limit != NULL && !parse_size(heap_limit, &options->heap_limit)) {
+        fprintf(stderr, "Invalid value for CRISPY_HEAP_LIMIT: '%s'\n", heap_limit);
+        exit(1);
+    }
+}
 
 int main(int argc, char **argv) {
-    if (argc == 1) {
-        run_repl();
-    } else if (argc == 2) {
-        run_file(argv[1]);
+    RunOptions options = {INCREMENTAL_GC, GC_SLICE_BUDGET, false, false, NULL, HEAP_GROWTH, MIN_HEAP, MAX_HEAP,
+                          HEAP_LIMIT, GC_THREADS, BACKGROUND_SWEEP, COMPACTING_GC};
+    const char *file_name = NULL;
+
+    // command line options take precedence over the environment
+    read_environment(&options);
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+
+        if (strcmp(arg, "--incremental-gc") == 0) {
+            options.incremental_gc = true;
+        } else if (strncmp(arg, "--gc-slice-budget=", 18) == 0) {
+            char *end;
+            options.gc_slice_budget = strtoull(arg + 18, &end, 10);
+
+            if (*end != '\0' || options.gc_slice_budget == 0) {
+                usage();
+            }
+        } else if (strcmp(arg, "--gc-max-pause") == 0) {
+            options.print_max_pause = true;
+        } else if (strcmp(arg, "--gc-stats") == 0) {
+            options.print_gc_stats = true;
+        } else if (strncmp(arg, "--heap-snapshot-on-exit=", 24) == 0) {
+            options.heap_snapshot = arg + 24;
+
+            if (*options.heap_snapshot == '\0') {
+                usage();
+            }
+        } else if (strcmp(arg, "--background-sweep") == 0) {
+            options.background_sweep = true;
+        } else if (strcmp(arg, "--compact-gc") == 0) {
+            options.compacting_gc = true;
+        } else if (strncmp(arg, "--gc-threads=", 13) == 0) {
+            if (!parse_threads(arg + 13, &options.gc_threads)) {
+                usage();
+            }
+        } else if (strncmp(arg, "--heap-growth=", 14) == 0) {
+            if (!parse_growth(arg + 14, &options.heap_growth)) {
+                usage();
+            }
+        } else if (strncmp(arg, "--min-heap=", 11) == 0) {
+            if (!parse_size(arg + 11, &options.min_heap)) {
+                usage();
+            }
+        } else if (strncmp(arg, "--max-heap=", 11) == 0) {
+            if (!parse_size(arg + 11, &options.max_heap)) {
+                usage();
+            }
+        } else if (strncmp(arg, "--heap-limit=", 13) == 0) {
+            if (!parse_size(arg + 13, &options.heap_limit)) {
+                usage();
+            }
+        } else if (arg[0] == '-' || file_name != NULL) {
+            usage();
+        } else {
+            file_name = arg;
+        }
+    }
+
+    if (file_name == NULL) {
+        run_repl(&options);
     } else {
-        fprintf(stderr, "Usage: calc");
+        run_file(file_name, &options);
     }
 
     return 0;
@@ -56,13 +231,14 @@ static char *read_file(const char *path) {
     return buffer;
 }
 
-static void run_file(const char *file_name) {
+static void run_file(const char *file_name, RunOptions *options) {
     Vm vm;
-    vm_init(&vm, false);
+    vm_init_with_options(&vm, false, options);
 
     char *source = read_file(file_name);
     InterpretResult result = interpret(&vm, source);
 
+    report_on_exit(&vm, options);
     vm_free(&vm);
     free(source);
 
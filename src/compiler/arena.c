@@ -0,0 +1,97 @@
+// Copyright (c) 2018 Felix Schoeller
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "arena.h"
+#include "../vm/options.h"
+
+// enough for pointers and 64 bit integers, which is all the compiler needs
+#define ARENA_ALIGNMENT 8
+#define ALIGN(size) (((size) + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1))
+
+void arena_init(Arena *arena) {
+    arena->chunk = NULL;
+    arena->spare = NULL;
+}
+
+static void free_chunks(ArenaChunk *chunk) {
+    while (chunk != NULL) {
+        ArenaChunk *previous = chunk->previous;
+        free(chunk);
+        chunk = previous;
+    }
+}
+
+void arena_free(Arena *arena) {
+    free_chunks(arena->chunk);
+    free_chunks(arena->spare);
+    arena_init(arena);
+}
+
+static ArenaChunk *new_chunk(Arena *arena, size_t size) {
+    // only the first spare chunk is checked, because all of them have the default size unless they are oversized
+    if (arena->spare != NULL && arena->spare->cap >= size) {
+        ArenaChunk *chunk = arena->spare;
+        arena->spare = chunk->previous;
+        return chunk;
+    }
+
+    size_t cap = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+    ArenaChunk *chunk = malloc(sizeof(ArenaChunk) + cap);
+
+    if (chunk == NULL) {
+        fprintf(stderr, "Could not allocate memory for the compiler\n");
+        exit(1);
+    }
+
+    chunk->cap = cap;
+    return chunk;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = ALIGN(size);
+
+    ArenaChunk *chunk = arena->chunk;
+
+    if (chunk == NULL || chunk->cap - chunk->used < size) {
+        chunk = new_chunk(arena, size);
+        chunk->used = 0;
+        chunk->previous = arena->chunk;
+        arena->chunk = chunk;
+    }
+
+    void *block = chunk->data + chunk->used;
+    chunk->used += size;
+
+    return block;
+}
+
+void *arena_calloc(Arena *arena, size_t size) {
+    void *block = arena_alloc(arena, size);
+    memset(block, 0, size);
+    return block;
+}
+
+ArenaMark arena_mark(Arena *arena) {
+    ArenaMark mark = {arena->chunk, arena->chunk != NULL ? arena->chunk->used : 0};
+    return mark;
+}
+
+void arena_release(Arena *arena, ArenaMark mark) {
+    while (arena->chunk != mark.chunk) {
+        ArenaChunk *chunk = arena->chunk;
+        arena->chunk = chunk->previous;
+
+        chunk->previous = arena->spare;
+        arena->spare = chunk;
+    }
+
+    if (mark.chunk != NULL) {
+        mark.chunk->used = mark.used;
+    }
+}
@@ -0,0 +1,74 @@
+// Copyright (c) 2018 Felix Schoeller
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+
+#ifndef CRISPY_ARENA_H
+#define CRISPY_ARENA_H
+
+#include <stddef.h>
+
+#include "../util/common.h"
+
+typedef struct arena_chunk_t {
+    struct arena_chunk_t *previous;
+    size_t cap;
+    size_t used;
+    unsigned char data[];
+} ArenaChunk;
+
+/*
+ * A bump allocator for memory, that is only needed while compiling.
+ * Allocations can't be freed individually. Instead, everything allocated after a mark is released at once.
+ */
+typedef struct {
+    // the chunk, that is currently allocated from
+    ArenaChunk *chunk;
+    // released chunks, which are reused before new ones are allocated
+    ArenaChunk *spare;
+} Arena;
+
+typedef struct {
+    ArenaChunk *chunk;
+    size_t used;
+} ArenaMark;
+
+void arena_init(Arena *arena);
+
+/**
+ * Frees all chunks of an arena.
+ * @param arena the arena.
+ */
+void arena_free(Arena *arena);
+
+/**
+ * Allocates a block of memory, which stays valid until the arena is released to an earlier mark or freed.
+ * @param arena the arena.
+ * @param size the size of the block in bytes.
+ * @return the block.
+ */
+void *arena_alloc(Arena *arena, size_t size);
+
+/**
+ * Same as arena_alloc, but the block is set to zero.
+ * @param arena the arena.
+ * @param size the size of the block in bytes.
+ * @return the block.
+ */
+void *arena_calloc(Arena *arena, size_t size);
+
+/**
+ * Remembers the current position of an arena.
+ * @param arena the arena.
+ * @return the mark, which can be passed to arena_release.
+ */
+ArenaMark arena_mark(Arena *arena);
+
+/**
+ * Releases everything, that was allocated after a mark. The released chunks are kept for later allocations.
+ * @param arena the arena.
+ * @param mark a mark of the same arena, which was created before all marks, that are still in use.
+ */
+void arena_release(Arena *arena, ArenaMark mark);
+
+#endif //CRISPY_ARENA_H
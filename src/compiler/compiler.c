@@ -36,8 +36,15 @@ static inline void advance(Vm *vm) {
 }
 
 static inline void open_scope(Vm *vm) {
-    ++vm->compiler.scope_depth;
-    var_ht_init(&vm->compiler.scope[vm->compiler.scope_depth], 8);
+    Compiler *compiler = &vm->compiler;
+
+    if (compiler->scope_depth + 1 >= SCOPES_MAX) {
+        error(compiler, "Too many nested scopes");
+    }
+
+    ++compiler->scope_depth;
+    compiler->scope_marks[compiler->scope_depth] = arena_mark(&compiler->arena);
+    var_ht_init(&compiler->scope[compiler->scope_depth], 8, &compiler->arena);
 }
 
 static void close_scope(Vm *vm) {
@@ -45,6 +52,7 @@ static void close_scope(Vm *vm) {
 
     compiler->vars_in_scope -= compiler->scope[compiler->scope_depth].size;
     var_ht_free(&compiler->scope[compiler->scope_depth]);
+    arena_release(&compiler->arena, compiler->scope_marks[compiler->scope_depth]);
     --compiler->scope_depth;
 }
 
@@ -100,6 +108,24 @@ static inline void remove_arg(Vm *vm) {
     CURR_FRAME(vm)->code_buffer.count--;
 }
 
+/**
+ * Emits a field access with its own inline cache.
+ * @param vm the vm.
+ * @param op_code either OP_GET_FIELD or OP_SET_FIELD.
+ * @param key_index the constant index of the key.
+ */
+static void emit_field(Vm *vm, OP_CODE op_code, uint16_t key_index) {
+    uint32_t cache_index = add_inline_cache(&CURR_FRAME(vm)->caches);
+
+    if (cache_index > UINT16_MAX) {
+        error(&vm->compiler, "Too many field accesses");
+    }
+
+    emit_short_arg(vm, op_code, (uint8_t) (key_index >> 8), (uint8_t) (key_index & 0xFF));
+    write_code_buffer(&CURR_FRAME(vm)->code_buffer, (uint8_t) (cache_index >> 8));
+    write_code_buffer(&CURR_FRAME(vm)->code_buffer, (uint8_t) (cache_index & 0xFF));
+}
+
 static inline OP_CODE last_instruction(Vm *vm) {
     uint8_t last = CURR_FRAME(vm)->code_buffer.code[CURR_FRAME(vm)->code_buffer.count - 1];
     return last <= OP_RETURN ? (OP_CODE) last : OP_NOP;
@@ -170,6 +196,12 @@ static void declare_var(Vm *vm, Token var_decl, bool assignable) {
     VarHTItemKey key = {var_decl.start, var_decl.length};
 
     var_ht_put(&vm->compiler.scope[vm->compiler.scope_depth], key, variable);
+
+    // the variables of a lambda live on the stack, so every call needs to reserve enough slots for them
+    CallFrame *frame = CURR_FRAME(vm);
+    if (vm->frame_count > 1 && frame->local_count < vm->compiler.vars_in_scope) {
+        frame->local_count = vm->compiler.vars_in_scope;
+    }
 }
 
 static void define_var(Vm *vm, Token identifier) {
@@ -205,12 +237,17 @@ void declare_natives(Vm *vm) {
     make_native(vm, "input", 5, std_input, 0, true);
     make_native(vm, "print", 5, std_print, 1, false);
     make_native(vm, "split", 5, std_split, 2, true);
+    make_native(vm, "substr", 6, std_substr, 3, true);
     make_native(vm, "append", 6, std_list_append, 2, true);
     make_native(vm, "list", 4, std_list, 1, true);
     make_native(vm, "exit", 4, std_exit, 1, true);
     make_native(vm, "num", 3, std_num, 1, true);
     make_native(vm, "str", 3, std_str, 1, true);
     make_native(vm, "len", 3, std_len, 1, true);
+    make_native(vm, "compact", 7, std_compact, 0, true);
+    make_native(vm, "gc", 2, std_gc, 0, true);
+    make_native(vm, "gc_stats", 8, std_gc_stats, 0, true);
+    make_native(vm, "heap_snapshot", 13, std_heap_snapshot, 1, true);
 }
 
 int compile(Vm *vm) {
@@ -223,6 +260,16 @@ int compile(Vm *vm) {
 
     int val = setjmp(error_buf);
     if (val) {
+        // the scopes, that were open when the error occurred, are freed together with the arena
+        vm->compiler.scope_depth = 0;
+        vm->compiler.vars_in_scope = vm->compiler.scope[0].size;
+
+        // the frames of the lambdas, that were being compiled
+        while (vm->frame_count > 1) {
+            call_frame_free(POP_FRAME(vm));
+        }
+
+        arena_free(&vm->compiler.arena);
         return val;
     }
 
@@ -231,39 +278,33 @@ int compile(Vm *vm) {
     } while (vm->compiler.token.type != TOKEN_EOF);
 
     emit_no_arg(vm, OP_RETURN);
+    arena_free(&vm->compiler.arena);
 
     return 0;
 
 }
 
-static void string(Vm *vm, bool quotation_marks) {
+/**
+ * Adds the current token as string to the constant pool.
+ * @param vm the vm.
+ * @param quotation_marks true if the token is a string literal, false if it is an identifier.
+ * @return the index of the constant.
+ */
+static uint16_t string_constant(Vm *vm, bool quotation_marks) {
     Compiler *compiler = &vm->compiler;
 
-    HTItemKey key;
-    key.key_ident_string = compiler->token.start;
-    key.ident_length = compiler->token.length;
-
-    CrispyValue item = ht_get(&vm->strings, key);
-
     ObjString *string;
-    CrispyValue value;
-
-    // string not yet in hashtable
-    if (item.type == NIL) {
-        if (quotation_marks) {
-            string = new_string(vm, compiler->token.start + 1, compiler->token.length - 2);
-        } else {
-            string = new_string(vm, compiler->token.start, compiler->token.length);
-        }
-        value = create_object((Object *) string);
-        ht_put(&vm->strings, key, value);
+    if (quotation_marks) {
+        string = new_interned_string(vm, compiler->token.start + 1, compiler->token.length - 2);
     } else {
-        string = (ObjString *) item.o_value;
-        value = create_object((Object *) string);
+        string = new_interned_string(vm, compiler->token.start, compiler->token.length);
     }
 
-    uint16_t pos = (uint16_t) add_constant(vm, value);
+    CrispyValue value = create_object((Object *) string);
+    return (uint16_t) add_constant(vm, value);
+}
 
+static void emit_constant(Vm *vm, uint16_t pos) {
     if (pos > UINT8_MAX) {
         uint8_t index_1 = (uint8_t) (pos >> 8);
         uint8_t index_2 = (uint8_t) (pos & 0xFF);
@@ -273,6 +314,10 @@ static void string(Vm *vm, bool quotation_marks) {
     }
 }
 
+static void string(Vm *vm, bool quotation_marks) {
+    emit_constant(vm, string_constant(vm, quotation_marks));
+}
+
 static void primary(Vm *vm) {
     Compiler *compiler = &vm->compiler;
 
@@ -296,7 +341,7 @@ static void primary(Vm *vm) {
             double res;
 
             res = strtod(str, NULL);
-            uint16_t pos = (uint16_t) add_constant(vm, create_number(res));
+            uint16_t pos = (uint16_t) add_constant(vm, create_integral(res));
 
             if (pos > 255) {
                 uint8_t index_1 = (uint8_t) (pos >> 8);
@@ -316,7 +361,7 @@ static void primary(Vm *vm) {
             uint64_t res;
 
             res = strtoul(str, NULL, 16);
-            uint16_t pos = (uint16_t) add_constant(vm, create_number(res));
+            uint16_t pos = (uint16_t) add_constant(vm, create_integral(res));
 
             if (pos > 255) {
                 uint8_t index_1 = (uint8_t) (pos >> 8);
@@ -385,13 +430,13 @@ static void primary(Vm *vm) {
                 if (!check(vm, TOKEN_CLOSE_BRACE) && !check(vm, TOKEN_EOF)) {
                     do {
                         // consume key
-                        string(vm, true);
+                        uint16_t key = string_constant(vm, true);
                         advance(vm);
                         consume(vm, TOKEN_COLON, "Expected ':' between key and value in dictionary");
                         // consume value
                         expr(vm);
 
-                        emit_no_arg(vm, OP_STRUCT_SET);
+                        emit_field(vm, OP_SET_FIELD, key);
                     } while (match(vm, TOKEN_COMMA));
                 }
 
@@ -477,10 +522,24 @@ static void primary_expr(Vm *vm) {
                         error(&vm->compiler, "Expected identifier after '.'");
                     }
 
-                    string(vm, false);
+                    uint16_t key = string_constant(vm, false);
                     advance(vm);
 
-                    handle_struct_assign(vm);
+                    switch (vm->compiler.token.type) {
+                        case TOKEN_EQUALS:
+                            advance(vm);
+                            expr(vm);
+                            emit_field(vm, OP_SET_FIELD, key);
+                            break;
+                        case TOKEN_PLUS_PLUS:
+                        case TOKEN_MINUS_MINUS:
+                            emit_constant(vm, key);
+                            handle_struct_assign(vm);
+                            break;
+                        default:
+                            emit_field(vm, OP_GET_FIELD, key);
+                            break;
+                    }
                 }
                 break;
             }
@@ -625,13 +684,16 @@ static void lambda(Vm *vm) {
     CallFrame *lambda_frame = new_call_frame();
     PUSH_FRAME(vm, lambda_frame);
 
+    // the variables of a lambda are numbered from 0, the arguments are already in the first slots when it is called
+    uint32_t enclosing_vars = vm->compiler.vars_in_scope;
+    vm->compiler.vars_in_scope = 0;
+
     uint8_t num_params = 0;
 
     if (!check(vm, TOKEN_ARROW)) {
         do {
             Token param = consume(vm, TOKEN_IDENTIFIER, "Expected parameter name");
             declare_var(vm, param, true);
-            define_var(vm, param);
             ++num_params;
         } while (match(vm, TOKEN_COMMA));
     }
@@ -642,9 +704,6 @@ static void lambda(Vm *vm) {
 
     consume(vm, TOKEN_ARROW, "Expected '->' after parameter list");
 
-    // lambda object itself
-    emit_no_arg(vm, OP_POP);
-
     expr(vm);
     emit_no_arg(vm, OP_RETURN);
 
@@ -662,6 +721,7 @@ static void lambda(Vm *vm) {
     ObjLambda *lambda = new_lambda(vm, num_params);
     lambda->call_frame = lambda_frame;
     lambda->call_frame->ip = lambda->call_frame->code_buffer.code;
+    track_memory(vm, sizeof(ObjLambda), object_size((Object *) lambda));
 
     uint16_t pos = (uint16_t) add_constant(vm, create_object((Object *) lambda));
 
@@ -674,7 +734,7 @@ static void lambda(Vm *vm) {
     }
 
     close_scope(vm);
-
+    vm->compiler.vars_in_scope = enclosing_vars;
 }
 
 static void block_expr(Vm *vm) {
@@ -745,6 +805,11 @@ static void var_decl(Vm *vm, bool assignable) {
         expr(vm);
         consume_optional(vm, TOKEN_SEMICOLON);
         define_var(vm, identifier);
+    } else {
+        // the variable has to exist before it is first assigned, because assignments load it first
+        consume_optional(vm, TOKEN_SEMICOLON);
+        emit_no_arg(vm, OP_NIL);
+        define_var(vm, identifier);
     }
 }
 
@@ -8,6 +8,7 @@
 
 #include "scanner.h"
 #include "variables.h"
+#include "arena.h"
 #include "../vm/options.h"
 #include "../vm/hashtable.h"
 
@@ -18,8 +19,12 @@ typedef struct {
 
     Scanner scanner;
 
+    // the global scope (0) is allocated with malloc, because it outlives a single compilation in interactive mode.
+    // All other scopes are allocated from the arena and released when they are closed
     VarHashTable scope[SCOPES_MAX];
+    ArenaMark scope_marks[SCOPES_MAX];
     uint32_t scope_depth;
+    Arena arena;
     uint32_t vars_in_scope;
 
     bool print_expr;
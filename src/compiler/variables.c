@@ -15,12 +15,26 @@ uint32_t var_hash(VarHTItemKey key) {
     return hash_string(key.key_ident_string, key.ident_length);
 }
 
-void var_ht_init(VarHashTable *ht, uint32_t init_cap) {
+void var_ht_init(VarHashTable *ht, uint32_t init_cap, Arena *arena) {
     ht->cap = (uint32_t) next_pow_of_2(init_cap);
     ht->size = 0;
-    ht->buckets = NULL;
+    ht->arena = arena;
+
+    if (arena != NULL) {
+        ht->buckets = arena_calloc(arena, ht->cap * sizeof(VarHTItem *));
+    } else {
+        ht->buckets = calloc(ht->cap, sizeof(VarHTItem *));
+    }
+}
 
-    ht->buckets = calloc(ht->cap, sizeof(VarHTItem *));
+static VarHTItem *alloc_item(VarHashTable *ht) {
+    return ht->arena != NULL ? arena_alloc(ht->arena, sizeof(VarHTItem)) : malloc(sizeof(VarHTItem));
+}
+
+static void free_item(VarHashTable *ht, VarHTItem *item) {
+    if (ht->arena == NULL) {
+        free(item);
+    }
 }
 
 static void free_bucket(VarHTItem *bucket) {
@@ -33,6 +47,11 @@ static void free_bucket(VarHTItem *bucket) {
 }
 
 void var_ht_free(VarHashTable *ht) {
+    if (ht->arena != NULL) {
+        ht->buckets = NULL;
+        return;
+    }
+
     for (int i = 0; i < ht->cap; ++i) {
         free_bucket(ht->buckets[i]);
     }
@@ -49,16 +68,17 @@ static bool equals(VarHTItemKey first, VarHTItemKey second) {
 
 /**
  * Insert an item into a bucket.
+ * @param ht the table.
  * @param bucket the bucket.
  * @param key the key.
  * @param type the key type.
  * @param new_item the item to insert.
  * @return true if the key already was in the map, false if it had to be created.
  */
-static bool insert(VarHTItem **bucket, VarHTItemKey key, VarHTItem *new_item) {
+static bool insert(VarHashTable *ht, VarHTItem **bucket, VarHTItemKey key, VarHTItem *new_item) {
     if (equals((*bucket)->key, key)) {
         VarHTItem *next = (*bucket)->next;
-        free(*bucket);
+        free_item(ht, *bucket);
         *bucket = new_item;
         (*bucket)->next = next;
         return true;
@@ -70,7 +90,7 @@ static bool insert(VarHTItem **bucket, VarHTItemKey key, VarHTItem *new_item) {
     while (*current) {
         if (equals((*current)->key, key)) {
             VarHTItem *next = (*current)->next;
-            free(*current);
+            free_item(ht, *current);
             *current = new_item;
             (*current)->next = next;
             return true;
@@ -86,7 +106,7 @@ static bool insert(VarHTItem **bucket, VarHTItemKey key, VarHTItem *new_item) {
 
 static void resize(VarHashTable *ht) {
     VarHashTable new_ht;
-    var_ht_init(&new_ht, (uint32_t) next_pow_of_2(ht->cap + 1));
+    var_ht_init(&new_ht, (uint32_t) next_pow_of_2(ht->cap + 1), ht->arena);
 
     for (uint32_t i = 0; i < ht->cap; ++i) {
         VarHTItem *item = ht->buckets[i];
@@ -135,16 +155,16 @@ void var_ht_delete(VarHashTable *ht, VarHTItemKey key) {
 
 void var_ht_put(VarHashTable *ht, VarHTItemKey key, Variable value) {
     uint32_t index = var_hash(key) & (ht->cap - 1);
-    VarHTItem *new_item = malloc(sizeof(VarHTItem));
-    new_item->next = NULL;
-    new_item->key = key;
-    new_item->value = value;
+    VarHTItem *item = alloc_item(ht);
+    item->next = NULL;
+    item->key = key;
+    item->value = value;
 
     bool already_inside = false;
     if (ht->buckets[index] == NULL) {
-        ht->buckets[index] = new_item;
+        ht->buckets[index] = item;
     } else {
-        already_inside = insert(&ht->buckets[index], key, new_item);
+        already_inside = insert(ht, &ht->buckets[index], key, item);
     }
 
     if (!already_inside) {
@@ -7,6 +7,7 @@
 #define CALC_VARIABLES_H
 
 #include "../util/common.h"
+#include "arena.h"
 
 typedef struct {
     int index;
@@ -31,12 +32,25 @@ typedef struct {
     uint32_t size;
 
     VarHTItem **buckets;
+    // the arena, that the buckets and items are allocated from or NULL if they are allocated with malloc
+    Arena *arena;
 } VarHashTable;
 
 uint32_t var_hash(VarHTItemKey key);
 
-void var_ht_init(VarHashTable *ht, uint32_t init_cap);
-
+/**
+ * Initializes a table.
+ * @param ht the table.
+ * @param init_cap the initial capacity.
+ * @param arena the arena, that the table is allocated from or NULL if it should use malloc.
+ */
+void var_ht_init(VarHashTable *ht, uint32_t init_cap, Arena *arena);
+
+/**
+ * Frees a table. This does nothing for tables, that are allocated from an arena, because their memory is released
+ * together with the arena.
+ * @param ht the table.
+ */
 void var_ht_free(VarHashTable *ht);
 
 Variable *var_ht_get(VarHashTable *ht, VarHTItemKey key);
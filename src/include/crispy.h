@@ -7,5 +7,6 @@
 #define CRISPY_CRISPY_H
 
 #include "../vm/vm.h"
+#include "../vm/snapshot.h"
 
 #endif //CRISPY_CRISPY_H
@@ -11,6 +11,7 @@
 #include "../vm/dictionary.h"
 #include "../vm/vm.h"
 #include "../vm/list.h"
+#include "../vm/snapshot.h"
 #include "../util/ioutil.h"
 
 CrispyValue std_println(CrispyValue *value) {
@@ -28,8 +29,8 @@ CrispyValue std_print(CrispyValue *value) {
 CrispyValue std_exit(CrispyValue *value, Vm *vm) {
     vm_free(vm);
 
-    if (value[0].type == NUMBER) {
-        int ret_val = (int) value[0].d_value;
+    if (CHECK_NUM(value[0])) {
+        int ret_val = (int) AS_NUM(value[0]);
         exit(ret_val);
     }
 
@@ -39,21 +40,24 @@ CrispyValue std_exit(CrispyValue *value, Vm *vm) {
 CrispyValue std_str(CrispyValue *value, Vm *vm) {
     ObjString *string = NULL;
 
-    switch (value->type) {
+    switch (VALUE_TYPE(*value)) {
         case NUMBER: {
             char s[23];
-            snprintf(s, 23, "%.15g", value->d_value);
+            snprintf(s, 23, "%.15g", AS_NUM(*value));
             // crispy strings are not null terminated
             string = new_string(vm, s, strlen(s));
             break;
         }
         case OBJECT: {
-            Object *object = value->o_value;
+            Object *object = AS_OBJ(*value);
 
             switch (object->type) {
                 case OBJ_STRING:
                     string = (ObjString *) object;
                     break;
+                case OBJ_ROPE:
+                case OBJ_SLICE:
+                    return *value;
                 case OBJ_LAMBDA:
                     // TODO arity
                     string = new_string(vm, "<function>", 10);
@@ -71,11 +75,15 @@ CrispyValue std_str(CrispyValue *value, Vm *vm) {
                 case OBJ_LIST:
                     string = new_string(vm, "<list>", 6);
                     break;
+                case OBJ_VECTOR_NODE:
+                    // the nodes of persistent lists are never visible to the program
+                    string = new_string(vm, "<invalid object>", 16);
+                    break;
             }
             break;
         }
         case BOOLEAN: {
-            string = value->p_value ? new_string(vm, "true", 4) : new_string(vm, "false", 5);
+            string = AS_BOOL(*value) ? new_string(vm, "true", 4) : new_string(vm, "false", 5);
             break;
         }
         case NIL:
@@ -87,19 +95,21 @@ CrispyValue std_str(CrispyValue *value, Vm *vm) {
 }
 
 CrispyValue std_len(CrispyValue *value, Vm *vm) {
-    if (value->type != OBJECT) {
+    if (!CHECK_OBJ(*value)) {
         vm->err_flag = true;
         // TODO include type
         return create_object((Object *) new_string(vm, "Value has no length", 19));
     }
 
-    Object *obj = value->o_value;
+    Object *obj = AS_OBJ(*value);
 
     switch (obj->type) {
         case OBJ_LIST:
-            return create_number(((ObjList *) obj)->content.count);
+            return create_int(list_length((ObjList *) obj));
         case OBJ_STRING:
-            return create_number(((ObjString *) obj)->length);
+        case OBJ_ROPE:
+        case OBJ_SLICE:
+            return create_int(string_length(obj));
         default:
             vm->err_flag = true;
             // TODO include type
@@ -108,53 +118,87 @@ CrispyValue std_len(CrispyValue *value, Vm *vm) {
 }
 
 CrispyValue std_list_append(CrispyValue *value, Vm *vm) {
-    if (value->type != OBJECT || value->o_value->type != OBJ_LIST) {
+    if (!CHECK_OBJ_TYPE(value[0], OBJ_LIST)) {
         vm->err_flag = true;
         return create_object((Object *) new_string(vm, "You can only append to list", 27));
     }
 
-    ObjList *list = (ObjList *) value->o_value;
+    ObjList *list = (ObjList *) AS_OBJ(value[0]);
+    write_barrier(vm, (Object *) list, value[1]);
+
+    size_t old_size = list_memory(list);
     list_append(list, value[1]);
+    track_memory(vm, old_size, list_memory(list));
     return value[0];
 }
 
 CrispyValue std_split(CrispyValue *value, Vm *vm) {
-    if (value->type != OBJECT || value->o_value->type != OBJ_STRING) {
+    if (!CHECK_STRING(value[0])) {
         vm->err_flag = true;
         return create_object((Object *) new_string(vm, "Only strings can be splitted", 28));
     }
 
-    if (value[1].type != OBJECT || value[1].o_value->type != OBJ_STRING) {
+    if (!CHECK_STRING(value[1])) {
         vm->err_flag = true;
         return create_object((Object *) new_string(vm, "Only strings can be used as delimiter for 'split'", 49));
     }
 
-    ObjString *string = (ObjString *) value->o_value;
-    ObjString *delim = (ObjString *) (value + 1)->o_value;
+    Object *string_obj = AS_OBJ(value[0]);
+    const char *string = string_chars(vm, string_obj);
+    size_t string_len = string_length(string_obj);
+    const char *delim = string_chars(vm, AS_OBJ(value[1]));
+    size_t delim_len = string_length(AS_OBJ(value[1]));
 
-    if (delim->length > string->length) {
+    if (delim_len > string_len) {
         return create_object((Object *) new_list(vm, 0));
     }
 
     ObjList *tokens = new_list(vm, 0);
-    size_t length = string->length - delim->length;
+    size_t old_size = list_memory(tokens);
+    size_t length = string_len - delim_len;
     uint32_t offset = 0;
 
     for (uint32_t i = 0; i < length; ++i) {
-        if (memcmp(string->start + i, delim->start, delim->length) == 0) {
-            i += delim->length;
-            ObjString *token = new_string(vm, &string->start[offset], i - offset - delim->length);
-            list_append(tokens, create_object((Object *) token));
+        if (memcmp(string + i, delim, delim_len) == 0) {
+            i += delim_len;
+            Object *token = new_substring(vm, string_obj, offset, i - offset - delim_len);
+            list_append(tokens, create_object(token));
             offset = i;
         }
     }
 
-    ObjString *token = new_string(vm, &string->start[offset], string->length - offset);
-    list_append(tokens, create_object((Object *) token));
+    Object *token = new_substring(vm, string_obj, offset, string_len - offset);
+    list_append(tokens, create_object(token));
+    track_memory(vm, old_size, list_memory(tokens));
 
     return create_object((Object *) tokens);
 }
 
+CrispyValue std_substr(CrispyValue *value, Vm *vm) {
+    if (!CHECK_STRING(value[0])) {
+        vm->err_flag = true;
+        return create_object((Object *) new_string(vm, "substr() can only be used on strings", 36));
+    }
+
+    // the bounds are checked like indices, so integral doubles are accepted as well
+    int64_t start;
+    int64_t end;
+
+    if (!to_index(value[1], &start) || !to_index(value[2], &end)) {
+        vm->err_flag = true;
+        return create_object((Object *) new_string(vm, "The bounds of substr() have to be integers", 42));
+    }
+
+    Object *string = AS_OBJ(value[0]);
+
+    if (start < 0 || start > end || end > string_length(string)) {
+        vm->err_flag = true;
+        return create_object((Object *) new_string(vm, "Invalid bounds for substr()", 27));
+    }
+
+    return create_object(new_substring(vm, string, (size_t) start, (size_t) (end - start)));
+}
+
 CrispyValue std_input(CrispyValue *value, Vm *vm) {
     char *line;
     ssize_t length = read_line(&line);
@@ -172,20 +216,25 @@ CrispyValue std_input(CrispyValue *value, Vm *vm) {
 }
 
 CrispyValue std_list(CrispyValue *value, Vm *vm) {
-    switch (value[0].type) {
+    switch (VALUE_TYPE(value[0])) {
         case OBJECT:
-            switch (value->o_value->type) {
+            switch (AS_OBJ(value[0])->type) {
                 case OBJ_LIST:
                     return *value;
-                case OBJ_STRING: {
-                    ObjString *string = (ObjString *) value->o_value;
-                    ObjList *list = new_list(vm, string->length);
-
-                    for (uint32_t i = 0; i < string->length; ++i) {
-                        list->content.values[i] =
-                                create_object((Object *) new_string(vm, string->start + i, 1));
+                case OBJ_STRING:
+                case OBJ_ROPE:
+                case OBJ_SLICE: {
+                    const char *string = string_chars(vm, AS_OBJ(value[0]));
+                    size_t length = string_length(AS_OBJ(value[0]));
+                    ObjList *list = new_list(vm, length);
+                    size_t old_size = list_memory(list);
+
+                    for (uint32_t i = 0; i < length; ++i) {
+                        list_append(list, create_object((Object *) vm->single_chars[(uint8_t) string[i]]));
                     }
 
+                    track_memory(vm, old_size, list_memory(list));
+
                     return create_object((Object *) list);
                 }
                 default:
@@ -199,18 +248,89 @@ CrispyValue std_list(CrispyValue *value, Vm *vm) {
 }
 
 CrispyValue std_num(CrispyValue *value, Vm *vm) {
-    if (value[0].type != OBJECT || value[0].o_value->type != OBJ_STRING) {
+    if (!CHECK_STRING(value[0])) {
         vm->err_flag = true;
         return create_object((Object *) new_string(vm, "num() can only be used on strings", 33));
     }
 
-    ObjString *string = (ObjString *) value[0].o_value;
-    char temp[string->length + 1];
-    memcpy(temp, string->start, string->length);
-    temp[string->length] = '\0';
+    size_t length = string_length(AS_OBJ(value[0]));
+    char temp[length + 1];
+    copy_string_chars(AS_OBJ(value[0]), temp);
+    temp[length] = '\0';
 
     double res;
     res = strtod(temp, NULL);
 
-    return create_number(res);
+    return create_integral(res);
+}
+
+CrispyValue std_compact(CrispyValue *value, Vm *vm) {
+    // the interpreter doesn't hold any object pointers during a call without arguments, so objects may be moved.
+    // The compaction needs an idle gc, gc() aborts an unfinished incremental cycle and compact_heap finishes the sweep
+    gc(vm);
+    compact_heap(vm);
+
+    return create_nil();
+}
+
+CrispyValue std_gc(CrispyValue *value, Vm *vm) {
+    full_gc(vm);
+
+    return create_nil();
+}
+
+static void put_stat(Vm *vm, ObjDict *dict, const char *key, CrispyValue value) {
+    size_t old_size = dict_memory(dict);
+    dict_put(dict, new_interned_string(vm, key, strlen(key)), value, &vm->slabs);
+    track_memory(vm, old_size, dict_memory(dict));
+}
+
+CrispyValue std_gc_stats(CrispyValue *value, Vm *vm) {
+    GcStats stats;
+    gc_stats(vm, &stats);
+
+    ObjDict *result = new_dict(vm);
+    put_stat(vm, result, "full_collections", create_int((int64_t) stats.full_collections));
+    put_stat(vm, result, "minor_collections", create_int((int64_t) stats.minor_collections));
+    put_stat(vm, result, "compactions", create_int((int64_t) stats.compactions));
+    put_stat(vm, result, "allocated", create_int((int64_t) stats.allocated));
+    put_stat(vm, result, "freed", create_int((int64_t) stats.freed));
+    put_stat(vm, result, "heap", create_int((int64_t) stats.heap));
+    put_stat(vm, result, "total_pause_ms", create_number(stats.total_pause / 1e6));
+    put_stat(vm, result, "max_pause_ms", create_number(stats.max_pause / 1e6));
+
+    ObjDict *live = new_dict(vm);
+    for (int i = 0; i < OBJECT_TYPE_COUNT; ++i) {
+        put_stat(vm, live, object_type_name((ObjectType) i), create_int((int64_t) stats.live_objects[i]));
+    }
+    put_stat(vm, result, "live_objects", create_object((Object *) live));
+
+    ObjDict *pauses = new_dict(vm);
+    for (uint32_t i = 0; i < GC_PAUSE_BUCKETS; ++i) {
+        put_stat(vm, pauses, gc_pause_label(i), create_int((int64_t) stats.pauses[i]));
+    }
+    put_stat(vm, result, "pauses", create_object((Object *) pauses));
+
+    return create_object((Object *) result);
+}
+
+CrispyValue std_heap_snapshot(CrispyValue *value, Vm *vm) {
+    if (!CHECK_STRING(value[0])) {
+        vm->err_flag = true;
+        return create_object((Object *) new_string(vm, "heap_snapshot() expects a path", 30));
+    }
+
+    size_t length = string_length(AS_OBJ(value[0]));
+    char path[length + 1];
+    copy_string_chars(AS_OBJ(value[0]), path);
+    path[length] = '\0';
+
+    int64_t written = write_heap_snapshot(vm, path);
+
+    if (written < 0) {
+        vm->err_flag = true;
+        return create_object((Object *) new_string(vm, "Could not write the heap snapshot", 33));
+    }
+
+    return create_int(written);
 }
@@ -21,6 +21,8 @@ CrispyValue std_len(CrispyValue *value, Vm *vm);
 
 CrispyValue std_split(CrispyValue *value, Vm *vm);
 
+CrispyValue std_substr(CrispyValue *value, Vm *vm);
+
 CrispyValue std_input(CrispyValue *value, Vm *vm);
 
 CrispyValue std_list(CrispyValue *value, Vm *vm);
@@ -29,4 +31,36 @@ CrispyValue std_list_append(CrispyValue *value, Vm *vm);
 
 CrispyValue std_num(CrispyValue *value, Vm *vm);
 
+/**
+ * Collects the garbage and compacts the heap.
+ * @param value unused.
+ * @param vm the current vm.
+ * @return nil.
+ */
+CrispyValue std_compact(CrispyValue *value, Vm *vm);
+
+/**
+ * Performs a full collection (including the sweep).
+ * @param value unused.
+ * @param vm the current vm.
+ * @return nil.
+ */
+CrispyValue std_gc(CrispyValue *value, Vm *vm);
+
+/**
+ * Returns the gc statistics (see GcStats) as a dictionary.
+ * @param value unused.
+ * @param vm the current vm.
+ * @return the dictionary.
+ */
+CrispyValue std_gc_stats(CrispyValue *value, Vm *vm);
+
+/**
+ * Writes a heap snapshot (see snapshot.h) into a file.
+ * @param value the path of the file.
+ * @param vm the current vm.
+ * @return the number of objects in the snapshot.
+ */
+CrispyValue std_heap_snapshot(CrispyValue *value, Vm *vm);
+
 #endif //CRISPY_STDLIB_H
@@ -62,6 +62,18 @@ static int jump_instruction(const char *name, Vm *vm, int offset) {
     return offset + 3;
 }
 
+static int field_instruction(const char *name, Vm *vm, int offset) {
+    uint8_t *code = CURR_FRAME(vm)->code_buffer.code;
+    uint16_t constant_index = (code[offset + 1] << 8) | code[offset + 2];
+    uint16_t cache_index = (code[offset + 3] << 8) | code[offset + 4];
+
+    printf("%-16s %4d '", name, constant_index);
+    print_value(CURR_FRAME(vm)->constants.values[constant_index], false, false);
+    printf("' (cache %d)\n", cache_index);
+
+    return offset + 5;
+}
+
 static int double_instruction(const char *name, Vm *vm, int offset) {
     uint8_t first = CURR_FRAME(vm)->code_buffer.code[offset + 1];
     uint8_t second = CURR_FRAME(vm)->code_buffer.code[offset + 2];
@@ -176,6 +188,10 @@ int disassemble_instruction(Vm *vm, int offset) {
             return simple_instruction("OP_STRUCT_GET", offset);
         case OP_STRUCT_PEEK:
             return simple_instruction("OP_STRUCT_PEEK", offset);
+        case OP_GET_FIELD:
+            return field_instruction("OP_GET_FIELD", vm, offset);
+        case OP_SET_FIELD:
+            return field_instruction("OP_SET_FIELD", vm, offset);
         default:
             printf("Unknown instruction %d\n", instruction);
             return offset + 1;
@@ -12,54 +12,51 @@
 #include "value.h"
 #include "memory.h"
 
-// TODO cleanup
-static size_t ht_key_to_string(HTKeyType type, HTItemKey key, char **dest) {
-    switch (type) {
-        case HT_KEY_CSTRING:
-            *dest = strdup(key.key_c_string);
-            return strlen(key.key_c_string);
-        case HT_KEY_OBJSTRING: {
-            size_t size = (key.key_obj_string->length + 1) * sizeof(char);
-            char *string = malloc(size);
-            memcpy(string, key.key_obj_string->start, key.key_obj_string->length);
-            string[size - 1] = '\0';
-            *dest = string;
-            return key.key_obj_string->length;
-        }
-        case HT_KEY_INT: {
-            // all numbers represented by a 32 bit unsigned integer fit into 10 bytes
-            char *string = malloc(11 * sizeof(char));
-            sprintf(string, "%d", key.key_int);
-            *dest = string;
-            return strlen(string);
-        }
-        case HT_KEY_IDENT_STRING: {
-            size_t size = (key.ident_length + 1) * sizeof(char);
-            char *string = malloc(size);
-            memcpy(string, key.key_ident_string, key.ident_length);
-            string[size - 1] = '\0';
-            return key.ident_length;
+/*
+ * Iterates over the entries of a dictionary. Must be zero initialised before the first call to dict_next.
+ */
+typedef struct {
+    uint32_t index;
+    HTItem *item;
+
+    ObjString *key;
+    CrispyValue value;
+} DictIterator;
+
+/**
+ * Advances an iterator to the next entry.
+ * Shaped dictionaries are iterated in insertion order, hash tables in bucket order.
+ * @param dict the dictionary.
+ * @param iter the iterator.
+ * @return false if there are no more entries.
+ */
+static bool dict_next(ObjDict *dict, DictIterator *iter) {
+    if (dict->shape != NULL) {
+        if (iter->index >= dict->shape->slot_count) {
+            return false;
         }
+
+        iter->key = dict->shape->keys[iter->index];
+        iter->value = dict->slots[iter->index];
+        ++iter->index;
+        return true;
     }
 
-    return 0;
-}
+    if (iter->item != NULL) {
+        iter->item = iter->item->next;
+    }
 
-static void print_ht_key(HTKeyType type, HTItemKey key) {
-    switch (type) {
-        case HT_KEY_CSTRING:
-            printf("%s", key.key_c_string);
-            break;
-        case HT_KEY_OBJSTRING:
-            printf("%.*s", (int) key.key_obj_string->length, key.key_obj_string->start);
-            break;
-        case HT_KEY_INT:
-            printf("%d", key.key_int);
-            break;
-        case HT_KEY_IDENT_STRING:
-            printf("%.*s", (int) key.ident_length, key.key_ident_string);
-            break;
+    while (iter->item == NULL && iter->index < dict->content.cap) {
+        iter->item = dict->content.buckets[iter->index++];
     }
+
+    if (iter->item == NULL) {
+        return false;
+    }
+
+    iter->key = iter->item->key.key_obj_string;
+    iter->value = iter->item->value;
+    return true;
 }
 
 typedef struct {
@@ -96,7 +93,6 @@ static void write_string(StringArray *string_array, char *string, size_t length)
 }
 
 char *dict_to_string(ObjDict *dict) {
-    HashTable ht = dict->content;
     StringArray str_arr;
     init_string_array(&str_arr);
 
@@ -104,34 +100,30 @@ char *dict_to_string(ObjDict *dict) {
     size_t temp_size;
 
     bool first = true;
+    DictIterator iter = {0};
 
-    for (uint32_t i = 0; i < ht.cap; ++i) {
-        HTItem *bucket = ht.buckets[i];
-        while (bucket) {
-            if (first) {
-                first = false;
-                write_string(&str_arr, strdup("\""), 1);
-                size += 1;
-            } else {
-                write_string(&str_arr, strdup(", \""), 3);
-                size += 3;
-            }
-
-            char *key;
-            temp_size = ht_key_to_string(ht.key_type, bucket->key, &key);
-            write_string(&str_arr, key, temp_size);
-            size += temp_size;
-
+    while (dict_next(dict, &iter)) {
+        if (first) {
+            first = false;
+            write_string(&str_arr, strdup("\""), 1);
+            size += 1;
+        } else {
+            write_string(&str_arr, strdup(", \""), 3);
             size += 3;
-            write_string(&str_arr, strdup("\": "), 3);
+        }
 
-            char *val;
-            temp_size = value_to_string(bucket->value, &val);
-            write_string(&str_arr, val, temp_size);
-            size += temp_size;
+        char *key = malloc(iter.key->length * sizeof(char));
+        memcpy(key, iter.key->chars, iter.key->length);
+        write_string(&str_arr, key, iter.key->length);
+        size += iter.key->length;
 
-            bucket = bucket->next;
-        }
+        size += 3;
+        write_string(&str_arr, strdup("\": "), 3);
+
+        char *val;
+        temp_size = value_to_string(iter.value, &val);
+        write_string(&str_arr, val, temp_size);
+        size += temp_size;
     }
 
     char *string = malloc((size + 3)* sizeof(char));
@@ -157,27 +149,147 @@ void print_dict(ObjDict *dict, bool new_line) {
     const char *nl = (new_line) ? "\n" : "";
     const char *tab = (new_line) ? "\t" : "";
 
-    HashTable ht = dict->content;
-
     printf("{%s", nl);
     bool first = true;
+    DictIterator iter = {0};
 
-    for (uint32_t i = 0; i < ht.cap; ++i) {
-        HTItem *bucket = ht.buckets[i];
-        while (bucket) {
-            if (first) {
-                first = false;
-            } else {
-                printf(", ");
-            }
-            printf("%s\"", tab);
-            print_ht_key(ht.key_type, bucket->key);
-            printf("\": ");
-            print_value(bucket->value, new_line, true);
-
-            bucket = bucket->next;
+    while (dict_next(dict, &iter)) {
+        if (first) {
+            first = false;
+        } else {
+            printf(", ");
         }
+        printf("%s\"", tab);
+        printf("%.*s", (int) iter.key->length, iter.key->chars);
+        printf("\": ");
+        print_value(iter.value, new_line, true);
     }
 
     printf("}%s", nl);
-}
\ No newline at end of file
+}
+
+/**
+ * Moves all values of a shaped dictionary into its hash table.
+ * @param dict the dictionary.
+ * @param allocator the allocator for the items of the table.
+ */
+static void switch_to_table(ObjDict *dict, SlabAllocator *allocator) {
+    HashTable content;
+    ht_init(&content, HT_KEY_OBJSTRING, 8, allocator);
+
+    for (uint32_t i = 0; i < dict->shape->slot_count; ++i) {
+        HTItemKey key;
+        key.key_obj_string = dict->shape->keys[i];
+        ht_put(&content, key, dict->slots[i]);
+    }
+
+    FREE_ARR(dict->slots);
+    dict->slots = NULL;
+    dict->slot_cap = 0;
+    dict->shape = NULL;
+    dict->content = content;
+}
+
+CrispyValue dict_get(ObjDict *dict, ObjString *key) {
+    if (dict->shape != NULL) {
+        int64_t slot = shape_find_slot(dict->shape, key);
+        return slot < 0 ? create_nil() : dict->slots[slot];
+    }
+
+    HTItemKey ht_key;
+    ht_key.key_obj_string = key;
+    return ht_get(&dict->content, ht_key);
+}
+
+void dict_put(ObjDict *dict, ObjString *key, CrispyValue value, SlabAllocator *allocator) {
+    if (dict->shape != NULL) {
+        int64_t slot = shape_find_slot(dict->shape, key);
+
+        if (slot >= 0) {
+            dict->slots[slot] = value;
+            return;
+        }
+
+        switch_to_table(dict, allocator);
+    }
+
+    HTItemKey ht_key;
+    ht_key.key_obj_string = key;
+    ht_put(&dict->content, ht_key, value);
+}
+
+CrispyValue dict_get_field(ObjDict *dict, ObjString *key, InlineCache *cache) {
+    if (dict->shape == NULL) {
+        return dict_get(dict, key);
+    }
+
+    int64_t slot = shape_find_slot(dict->shape, key);
+
+    if (slot < 0) {
+        return create_nil();
+    }
+
+    cache->shape = dict->shape;
+    cache->transition = NULL;
+    cache->slot = (uint32_t) slot;
+
+    return dict->slots[slot];
+}
+
+void dict_set_field(ObjDict *dict, ObjString *key, CrispyValue value, InlineCache *cache, SlabAllocator *allocator) {
+    if (dict->shape == NULL) {
+        dict_put(dict, key, value, allocator);
+        return;
+    }
+
+    Shape *shape = dict->shape;
+    int64_t slot = shape_find_slot(shape, key);
+
+    if (slot >= 0) {
+        dict->slots[slot] = value;
+
+        cache->shape = shape;
+        cache->transition = NULL;
+        cache->slot = (uint32_t) slot;
+        return;
+    }
+
+    if (shape->slot_count >= MAX_SHAPE_SLOTS) {
+        dict_put(dict, key, value, allocator);
+        return;
+    }
+
+    if (shape->slot_count >= dict->slot_cap) {
+        dict_grow_slots(dict);
+    }
+
+    dict->shape = shape_transition(shape, key);
+    dict->slots[shape->slot_count] = value;
+
+    cache->shape = shape;
+    cache->transition = dict->shape;
+    cache->slot = shape->slot_count;
+}
+
+void dict_grow_slots(ObjDict *dict) {
+    dict->slot_cap = GROW_CAP(dict->slot_cap);
+    dict->slots = GROW_ARR(dict->slots, CrispyValue, dict->slot_cap);
+}
+
+size_t dict_memory(ObjDict *dict) {
+    if (dict->shape != NULL) {
+        return dict->slot_cap * sizeof(CrispyValue);
+    }
+
+    return dict->content.cap * sizeof(HTItem *) + dict->content.size * sizeof(HTItem);
+}
+
+void dict_free_content(ObjDict *dict) {
+    if (dict->shape != NULL) {
+        FREE_ARR(dict->slots);
+        dict->slots = NULL;
+        dict->slot_cap = 0;
+    } else {
+        ht_free(&dict->content);
+    }
+}
@@ -7,10 +7,17 @@
 #define CRISPY_DICTIONARY_H
 
 #include "hashtable.h"
+#include "shape.h"
 
 typedef struct {
     Object object;
 
+    // Dictionaries start out with a shape and store their values in slots.
+    // Once a key is used, that is not known at compile time, they switch to the hash table (shape is NULL).
+    Shape *shape;
+    CrispyValue *slots;
+    uint32_t slot_cap;
+
     HashTable content;
 } ObjDict;
 
@@ -18,4 +25,61 @@ void print_dict(ObjDict *dict, bool new_line);
 
 char *dict_to_string(ObjDict *dict);
 
+/**
+ * Retrieves the value of a key.
+ * @param dict the dictionary.
+ * @param key the interned key.
+ * @return the value or nil if the dictionary does not contain the key.
+ */
+CrispyValue dict_get(ObjDict *dict, ObjString *key);
+
+/**
+ * Sets the value of a key.
+ * If the key is not part of the shape of the dictionary, it switches to the hash table.
+ * @param dict the dictionary.
+ * @param key the interned key.
+ * @param value the value.
+ * @param allocator the allocator for the items of the hash table.
+ */
+void dict_put(ObjDict *dict, ObjString *key, CrispyValue value, SlabAllocator *allocator);
+
+/**
+ * Retrieves the value of a key, that is known at compile time and fills the inline cache of the access.
+ * @param dict the dictionary.
+ * @param key the interned key.
+ * @param cache the inline cache.
+ * @return the value or nil if the dictionary does not contain the key.
+ */
+CrispyValue dict_get_field(ObjDict *dict, ObjString *key, InlineCache *cache);
+
+/**
+ * Sets the value of a key, that is known at compile time and fills the inline cache of the access.
+ * New keys transition the dictionary to a new shape.
+ * @param dict the dictionary.
+ * @param key the interned key.
+ * @param value the value.
+ * @param cache the inline cache.
+ * @param allocator the allocator for the items of the hash table.
+ */
+void dict_set_field(ObjDict *dict, ObjString *key, CrispyValue value, InlineCache *cache, SlabAllocator *allocator);
+
+/**
+ * Makes sure, that the slot array of a dictionary can hold at least one more value.
+ * @param dict the dictionary.
+ */
+void dict_grow_slots(ObjDict *dict);
+
+/**
+ * Computes the size of the slots or the hash table of a dictionary.
+ * @param dict the dictionary.
+ * @return the size in bytes.
+ */
+size_t dict_memory(ObjDict *dict);
+
+/**
+ * Frees the slots or the hash table of a dictionary.
+ * @param dict the dictionary.
+ */
+void dict_free_content(ObjDict *dict);
+
 #endif //CRISPY_DICTIONARY_H
@@ -30,10 +30,7 @@ static bool equals(HTItemKey first, HTItemKey second, HTKeyType type) {
         case HT_KEY_CSTRING:
             return strcmp(first.key_c_string, second.key_c_string) == 0;
         case HT_KEY_OBJSTRING:
-            if (first.key_obj_string->length != second.key_obj_string->length) {
-                return false;
-            }
-            return cmp_strings(first.key_obj_string, second.key_obj_string) == 0;
+            return strings_equal(first.key_obj_string, second.key_obj_string);
         case HT_KEY_INT:
             return first.key_int == second.key_int;
         case HT_KEY_IDENT_STRING:
@@ -46,28 +43,32 @@ static bool equals(HTItemKey first, HTItemKey second, HTKeyType type) {
     return false;
 }
 
-void ht_init(HashTable *ht, HTKeyType key_type, uint32_t init_cap, void(*free_callback)(HTItem *)) {
+void ht_init(HashTable *ht, HTKeyType key_type, uint32_t init_cap, SlabAllocator *allocator) {
     ht->cap = (uint32_t) next_pow_of_2(init_cap);
     ht->size = 0;
     ht->buckets = NULL;
     ht->key_type = key_type;
-    ht->free_callback = free_callback;
+    ht->allocator = allocator;
 
     ht->buckets = calloc(ht->cap, sizeof(HTItem *));
 }
 
-static void free_bucket(HTItem *bucket, void(free_callback)(HTItem *)) {
+static inline void free_item(HashTable *ht, HTItem *item) {
+    slab_free(ht->allocator, item, sizeof(HTItem));
+}
+
+static void free_bucket(HashTable *ht, HTItem *bucket) {
     HTItem *item = bucket;
     while (item) {
         HTItem *next = item->next;
-        free_callback(item);
+        free_item(ht, item);
         item = next;
     }
 }
 
 void ht_free(HashTable *ht) {
     for (int i = 0; i < ht->cap; ++i) {
-        free_bucket(ht->buckets[i], ht->free_callback);
+        free_bucket(ht, ht->buckets[i]);
     }
     free(ht->buckets);
 }
@@ -80,10 +81,10 @@ void ht_free(HashTable *ht) {
  * @param new_item the item to insert.
  * @return true if the key already was in the map, false if it had to be created.
  */
-static bool insert(HTItem **bucket, HTItemKey key, HTKeyType type, HTItem *new_item) {
+static bool insert(HashTable *ht, HTItem **bucket, HTItemKey key, HTKeyType type, HTItem *new_item) {
     if (equals((*bucket)->key, key, type)) {
         HTItem *next = (*bucket)->next;
-        free(*bucket);
+        free_item(ht, *bucket);
         *bucket = new_item;
         (*bucket)->next = next;
         return true;
@@ -95,7 +96,7 @@ static bool insert(HTItem **bucket, HTItemKey key, HTKeyType type, HTItem *new_i
     while (*current) {
         if (equals((*current)->key, key, type)) {
             HTItem *next = (*current)->next;
-            free(*current);
+            free_item(ht, *current);
             *current = new_item;
             (*current)->next = next;
             return true;
@@ -110,25 +111,31 @@ static bool insert(HTItem **bucket, HTItemKey key, HTKeyType type, HTItem *new_i
 }
 
 static void resize(HashTable *ht) {
-    HashTable new_ht;
-    ht_init(&new_ht, ht->key_type, (uint32_t) next_pow_of_2(ht->cap + 1), ht->free_callback);
+    uint32_t new_cap = (uint32_t) next_pow_of_2(ht->cap + 1);
+    HTItem **new_buckets = calloc(new_cap, sizeof(HTItem *));
 
+    // the items are moved into the new buckets instead of being copied
     for (uint32_t i = 0; i < ht->cap; ++i) {
         HTItem *item = ht->buckets[i];
 
         while (item) {
-            ht_put(&new_ht, item->key, item->value);
-            item = item->next;
+            HTItem *next = item->next;
+            uint32_t index = hash(item->key, ht->key_type) & (new_cap - 1);
+
+            item->next = new_buckets[index];
+            new_buckets[index] = item;
+            item = next;
         }
     }
 
-    ht_free(ht);
-    *ht = new_ht;
+    free(ht->buckets);
+    ht->buckets = new_buckets;
+    ht->cap = new_cap;
 }
 
 void ht_put(HashTable *ht, HTItemKey key, CrispyValue value) {
     uint32_t index = hash(key, ht->key_type) & (ht->cap - 1);
-    HTItem *new_item = malloc(sizeof(HTItem));
+    HTItem *new_item = slab_alloc(ht->allocator, sizeof(HTItem));
     new_item->next = NULL;
     new_item->key = key;
     new_item->value = value;
@@ -137,7 +144,7 @@ void ht_put(HashTable *ht, HTItemKey key, CrispyValue value) {
     if (ht->buckets[index] == NULL) {
         ht->buckets[index] = new_item;
     } else {
-        already_inside = insert(&ht->buckets[index], key, ht->key_type, new_item);
+        already_inside = insert(ht, &ht->buckets[index], key, ht->key_type, new_item);
     }
 
     if (!already_inside) {
@@ -149,6 +156,72 @@ void ht_put(HashTable *ht, HTItemKey key, CrispyValue value) {
     }
 }
 
+void ht_delete(HashTable *ht, HTItemKey key) {
+    uint32_t index = hash(key, ht->key_type) & (ht->cap - 1);
+    HTItem **current = &ht->buckets[index];
+
+    while (*current) {
+        if (equals((*current)->key, key, ht->key_type)) {
+            HTItem *to_delete = *current;
+            *current = to_delete->next;
+            free_item(ht, to_delete);
+            --ht->size;
+            return;
+        }
+
+        current = &(*current)->next;
+    }
+}
+
+uint32_t ht_delete_if(HashTable *ht, bool (*predicate)(CrispyValue value)) {
+    if (ht->buckets == NULL) {
+        return 0;
+    }
+
+    uint32_t deleted = 0;
+
+    for (uint32_t i = 0; i < ht->cap; ++i) {
+        HTItem **current = &ht->buckets[i];
+
+        while (*current) {
+            if (predicate((*current)->value)) {
+                HTItem *to_delete = *current;
+                *current = to_delete->next;
+                free_item(ht, to_delete);
+                ++deleted;
+            } else {
+                current = &(*current)->next;
+            }
+        }
+    }
+
+    ht->size -= deleted;
+    return deleted;
+}
+
+void ht_relocate(HashTable *ht) {
+    if (ht->buckets == NULL) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < ht->cap; ++i) {
+        HTItem **current = &ht->buckets[i];
+
+        while (*current) {
+            HTItem *item = *current;
+
+            if (slab_evacuating(item, sizeof(HTItem))) {
+                HTItem *copy = slab_alloc(ht->allocator, sizeof(HTItem));
+                *copy = *item;
+                free_item(ht, item);
+                *current = copy;
+            }
+
+            current = &(*current)->next;
+        }
+    }
+}
+
 static CrispyValue *find(HTItem *bucket, HTItemKey wanted, HTKeyType type) {
     HTItem *item = bucket;
     CrispyValue *value = NULL;
@@ -174,21 +247,5 @@ CrispyValue ht_get(HashTable *ht, HTItemKey key) {
         }
     }
 
-    CrispyValue v;
-    v.type = NIL;
-    v.p_value = 0;
-    return v;
-}
-
-void free_string_literal(HTItem *item) {
-    free(item);
+    return create_nil();
 }
-
-void free_objstring(HTItem *item) {
-    free(item);
-    // Don't free string itself.
-    // All strings are interned and will be freed when the application exits
-}
-
-
-
@@ -7,6 +7,7 @@
 #define CRISPY_HASHMAP_H
 
 #include "value.h"
+#include "slab.h"
 
 typedef enum {
     HT_KEY_OBJSTRING, HT_KEY_CSTRING, HT_KEY_INT, HT_KEY_IDENT_STRING
@@ -34,25 +35,36 @@ typedef struct {
     uint32_t cap;
     uint32_t size;
 
-    void (*free_callback)(HTItem *);
+    // the items are allocated from here. Keys and values are never owned by the table
+    SlabAllocator *allocator;
 
     HTItem **buckets;
 } HashTable;
 
 uint32_t hash(HTItemKey key, HTKeyType type);
 
-void ht_init(HashTable *ht, HTKeyType key_type, uint32_t init_cap, void(*free_callback)(HTItem *));
+void ht_init(HashTable *ht, HTKeyType key_type, uint32_t init_cap, SlabAllocator *allocator);
 
 void ht_free(HashTable *ht);
 
-void free_string_literal(HTItem *item);
-
-void free_objstring(HTItem *item);
-
 CrispyValue ht_get(HashTable *ht, HTItemKey key);
 
 void ht_delete(HashTable *ht, HTItemKey key);
 
+/**
+ * Deletes all items, whose value matches a predicate.
+ * @param ht the hash table.
+ * @param predicate called once for every item.
+ * @return the number of deleted items.
+ */
+uint32_t ht_delete_if(HashTable *ht, bool (*predicate)(CrispyValue value));
+
+/**
+ * Moves the items, which are part of evacuated slabs (see slab_begin_evacuation), into other slabs.
+ * @param ht the hash table.
+ */
+void ht_relocate(HashTable *ht);
+
 void ht_put(HashTable *ht, HTItemKey key, CrispyValue value);
 
 #endif //CRISPY_HASHMAP_H
@@ -5,25 +5,149 @@
 
 #include "list.h"
 #include "value.h"
+#include "memory.h"
+
+/**
+ * Moves the numbers of a packed list into a generic value array.
+ * @param list the list.
+ */
+static void unpack(ObjList *list) {
+    NumberArray numbers = list->numbers;
+
+    ValueArray content;
+    val_arr_init(&content);
+    content.cap = numbers.cap;
+    content.count = numbers.count;
+    content.values = GROW_ARR(content.values, CrispyValue, content.cap);
+
+    for (uint64_t i = 0; i < numbers.count; ++i) {
+        content.values[i] = create_integral(numbers.values[i]);
+    }
+
+    FREE_ARR(numbers.values);
+
+    list->storage = LIST_GENERIC;
+    list->content = content;
+}
+
+/**
+ * Copies the elements of a persistent list into a generic value array.
+ * The nodes of the vector are left to the garbage collector, because they might be shared.
+ * @param list the list.
+ */
+static void flatten(ObjList *list) {
+    Vector vector = list->vector;
+
+    ValueArray content;
+    val_arr_init(&content);
+    content.cap = next_pow_of_2(vector.count);
+    content.count = vector.count;
+    content.values = GROW_ARR(content.values, CrispyValue, content.cap);
+
+    for (uint64_t i = 0; i < vector.count; ++i) {
+        content.values[i] = vector_get(&vector, i);
+    }
+
+    FREE_ARR(vector.tail);
+
+    list->storage = LIST_GENERIC;
+    list->content = content;
+}
+
+CrispyValue vector_get(Vector *vector, uint64_t index) {
+    uint64_t tail_offset = vector->count - vector->tail_count;
+
+    if (index >= tail_offset) {
+        return vector->tail[index - tail_offset];
+    }
+
+    ObjVectorNode *node = vector->root;
+
+    for (uint32_t level = vector->shift; level > 0; level -= VECTOR_BITS) {
+        node = (ObjVectorNode *) AS_OBJ(node->items[(index >> level) & VECTOR_MASK]);
+    }
+
+    return node->items[index & VECTOR_MASK];
+}
 
 void list_append(ObjList *list, CrispyValue value) {
+    if (list->storage == LIST_PERSISTENT) {
+        flatten(list);
+    }
+
+    if (list->storage == LIST_PACKED) {
+        if (CHECK_NUM(value)) {
+            NumberArray *numbers = &list->numbers;
+
+            if (numbers->count >= numbers->cap) {
+                numbers->cap = GROW_CAP(numbers->cap);
+                numbers->values = GROW_ARR(numbers->values, double, numbers->cap);
+            }
+
+            numbers->values[numbers->count++] = AS_NUM(value);
+            return;
+        }
+
+        unpack(list);
+    }
+
     write_value(&list->content, value);
 }
 
 bool list_add(ObjList *list, int64_t index, CrispyValue value) {
-    if (index < 0 || index >= list->content.count) {
+    if (index < 0 || index >= list_length(list)) {
         return false;
     }
 
+    if (list->storage == LIST_PERSISTENT) {
+        flatten(list);
+    }
+
+    if (list->storage == LIST_PACKED) {
+        if (CHECK_NUM(value)) {
+            list->numbers.values[index] = AS_NUM(value);
+            return true;
+        }
+
+        unpack(list);
+    }
+
     write_at(&list->content, (uint64_t) index, value);
     return true;
 }
 
 bool list_get(ObjList *list, int64_t index, CrispyValue *return_value) {
-    if (index < 0 || index >= list->content.count) {
+    if (index < 0 || index >= list_length(list)) {
         return false;
     }
 
-    *return_value = list->content.values[index];
+    *return_value = list_at(list, (uint64_t) index);
     return true;
-}
\ No newline at end of file
+}
+
+size_t list_memory(ObjList *list) {
+    switch (list->storage) {
+        case LIST_PACKED:
+            return list->numbers.cap * sizeof(double);
+        case LIST_GENERIC:
+            return list->content.cap * sizeof(CrispyValue);
+        case LIST_PERSISTENT:
+            return VECTOR_WIDTH * sizeof(CrispyValue);
+    }
+
+    return 0;
+}
+
+void list_free_content(ObjList *list) {
+    switch (list->storage) {
+        case LIST_PACKED:
+            FREE_ARR(list->numbers.values);
+            break;
+        case LIST_GENERIC:
+            val_arr_free(&list->content);
+            break;
+        case LIST_PERSISTENT:
+            FREE_ARR(list->vector.tail);
+            break;
+    }
+}
@@ -8,12 +8,106 @@
 
 #include "value.h"
 
+#define VECTOR_BITS 5
+#define VECTOR_WIDTH (1 << VECTOR_BITS)
+#define VECTOR_MASK (VECTOR_WIDTH - 1)
+
+typedef struct {
+    uint64_t cap;
+    uint64_t count;
+    double *values;
+} NumberArray;
+
+/*
+ * A node of a persistent vector. Nodes are never changed after they were created, so they can be shared between lists.
+ */
+typedef struct {
+    Object object;
+
+    // leaves store the elements, inner nodes store their children as objects (nil if not present)
+    CrispyValue items[VECTOR_WIDTH];
+} ObjVectorNode;
+
+/*
+ * A persistent vector (32-way trie with a tail buffer).
+ */
+typedef struct {
+    uint64_t count;
+
+    // the level of the root node (0 if the root is a leaf)
+    uint32_t shift;
+    // NULL if all elements fit into the tail
+    ObjVectorNode *root;
+
+    // the last (up to VECTOR_WIDTH) elements, owned by the list
+    CrispyValue *tail;
+    uint32_t tail_count;
+} Vector;
+
+typedef enum {
+    // only numbers, stored unboxed
+    LIST_PACKED,
+    // any values
+    LIST_GENERIC,
+    // the result of list + value, which shares its structure with the original list
+    LIST_PERSISTENT
+} ListStorage;
+
 typedef struct {
     Object object;
 
-    ValueArray content;
+    // lists start out packed and switch to generic storage on the first value, that is not a number.
+    // Persistent lists switch to generic storage once they are changed
+    ListStorage storage;
+
+    union {
+        NumberArray numbers;
+        ValueArray content;
+        Vector vector;
+    };
 } ObjList;
 
+/**
+ * Retrieves an element from a persistent vector without checking the bounds.
+ * @param vector the vector.
+ * @param index the index.
+ * @return the element.
+ */
+CrispyValue vector_get(Vector *vector, uint64_t index);
+
+/**
+ * Returns the number of elements in a list.
+ * @param list the list.
+ * @return the length.
+ */
+static inline uint64_t list_length(ObjList *list) {
+    switch (list->storage) {
+        case LIST_PACKED:
+            return list->numbers.count;
+        case LIST_GENERIC:
+            return list->content.count;
+        default:
+            return list->vector.count;
+    }
+}
+
+/**
+ * Returns the element at an index without checking the bounds.
+ * @param list the list.
+ * @param index the index (must be smaller than the length of the list).
+ * @return the element.
+ */
+static inline CrispyValue list_at(ObjList *list, uint64_t index) {
+    switch (list->storage) {
+        case LIST_PACKED:
+            return create_integral(list->numbers.values[index]);
+        case LIST_GENERIC:
+            return list->content.values[index];
+        default:
+            return vector_get(&list->vector, index);
+    }
+}
+
 /**
  * Appends an element to the end of a list.
  */
@@ -37,4 +131,18 @@ bool list_add(ObjList *list, int64_t index, CrispyValue value);
  */
 bool list_get(ObjList *list, int64_t index, CrispyValue *return_value);
 
+/**
+ * Computes the size of the element buffers of a list.
+ * The nodes of persistent lists are separate objects and therefore not included.
+ * @param list the list.
+ * @return the size in bytes.
+ */
+size_t list_memory(ObjList *list);
+
+/**
+ * Frees the elements of a list.
+ * @param list the list.
+ */
+void list_free_content(ObjList *list);
+
 #endif //CRISPY_LIST_H
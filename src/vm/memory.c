@@ -4,6 +4,10 @@
 // LICENSE file in the root directory of this source tree.
 
 #include <stdio.h>
+#include <time.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "memory.h"
 #include "value.h"
@@ -11,6 +15,7 @@
 #include "dictionary.h"
 #include "hashtable.h"
 #include "list.h"
+#include "shape.h"
 
 void *reallocate(void *previous, size_t size) {
     if (size <= 0) {
@@ -21,90 +26,925 @@ void *reallocate(void *previous, size_t size) {
     return realloc(previous, size);
 }
 
-static void mark(Object *object) {
-    if (object->marked) { return; }
+static void push_gray(ObjectArray *array, Object *object) {
+    if (array->count >= array->cap) {
+        array->cap = GROW_CAP(array->cap);
+        array->objects = GROW_ARR(array->objects, Object *, array->cap);
+    }
+
+    array->objects[array->count++] = object;
+}
+
+/**
+ * Marks an object gray. Its references are marked once it is taken from the gray stack.
+ * @param vm the current vm.
+ * @param gray the gray stack of the marking thread.
+ * @param object the object.
+ */
+static void mark(Vm *vm, ObjectArray *gray, Object *object) {
+    if (vm->parallel_marking) {
+        // another worker might try to mark the same object at the same time
+        if (__atomic_load_n(&object->marked, __ATOMIC_RELAXED)
+            || __atomic_exchange_n(&object->marked, 1, __ATOMIC_RELAXED)) {
+            return;
+        }
+    } else {
+        if (object->marked) { return; }
+
+        object->marked = 1;
+    }
+
+    push_gray(gray, object);
+}
+
+static void mark_values(Vm *vm, ObjectArray *gray, CrispyValue *values, uint64_t count) {
+    for (uint64_t i = 0; i < count; ++i) {
+        // the header of every referenced object is read, so it is requested early
+        if (i + GC_PREFETCH_DISTANCE < count && CHECK_OBJ(values[i + GC_PREFETCH_DISTANCE])) {
+            PREFETCH(AS_OBJ(values[i + GC_PREFETCH_DISTANCE]));
+        }
+
+        if (CHECK_OBJ(values[i])) {
+            mark(vm, gray, AS_OBJ(values[i]));
+        }
+    }
+}
 
-    if (object->type == OBJ_DICT) {
-        ObjDict *dict = (ObjDict *) object;
+/**
+ * Marks all objects referenced by an (already marked) object.
+ * @param vm the current vm.
+ * @param gray the gray stack of the marking thread.
+ * @param object the object.
+ */
+static void blacken(Vm *vm, ObjectArray *gray, Object *object) {
+    switch (object->type) {
+        case OBJ_DICT: {
+            ObjDict *dict = (ObjDict *) object;
+
+            // the keys of shaped dictionaries are marked together with their shape
+            if (dict->shape != NULL) {
+                mark_values(vm, gray, dict->slots, dict->shape->slot_count);
+                return;
+            }
 
-        for (int i = 0; i < dict->content.cap; ++i) {
-            HTItem *current = dict->content.buckets[i];
+            for (int i = 0; i < dict->content.cap; ++i) {
+                HTItem *current = dict->content.buckets[i];
 
-            while (current) {
-                mark((Object *) current->key.key_obj_string);
+                while (current) {
+                    mark(vm, gray, (Object *) current->key.key_obj_string);
 
-                if (current->value.type == OBJECT) {
-                    mark(current->value.o_value);
+                    if (CHECK_OBJ(current->value)) {
+                        mark(vm, gray, AS_OBJ(current->value));
+                    }
+
+                    current = current->next;
                 }
+            }
+            return;
+        }
+        case OBJ_LIST: {
+            ObjList *list = (ObjList *) object;
 
-                current = current->next;
+            switch (list->storage) {
+                case LIST_PACKED:
+                    // packed lists can't contain any objects
+                    return;
+                case LIST_GENERIC:
+                    mark_values(vm, gray, list->content.values, list->content.count);
+                    return;
+                case LIST_PERSISTENT:
+                    if (list->vector.root != NULL) {
+                        mark(vm, gray, (Object *) list->vector.root);
+                    }
+
+                    mark_values(vm, gray, list->vector.tail, list->vector.tail_count);
+                    return;
             }
+            return;
         }
+        case OBJ_VECTOR_NODE:
+            // unused items are nil, so inner nodes can be marked like leaves
+            mark_values(vm, gray, ((ObjVectorNode *) object)->items, VECTOR_WIDTH);
+            return;
+        case OBJ_SLICE:
+            mark(vm, gray, ((ObjSlice *) object)->parent);
+            return;
+        case OBJ_ROPE: {
+            ObjRope *rope = (ObjRope *) object;
 
-    } else if (object->type == OBJ_LIST) {
-        ObjList *list = (ObjList *) object;
+            // flattened ropes have released their children
+            if (rope->left != NULL) {
+                mark(vm, gray, rope->left);
+                mark(vm, gray, rope->right);
+            }
+            return;
+        }
+        case OBJ_LAMBDA: {
+            // constants of lambdas (e.g. string literals or nested lambdas) are only reachable through the lambda
+            CallFrame *frame = ((ObjLambda *) object)->call_frame;
 
-        for (int i = 0; i < list->content.count; ++i) {
-            CrispyValue *current = &list->content.values[i];
+            if (frame != NULL) {
+                mark_values(vm, gray, frame->constants.values, frame->constants.count);
+            }
+            return;
+        }
+        default:
+            return;
+    }
+}
+
+/**
+ * Blackens gray objects until either the gray stack is empty or the budget is used up.
+ * @param vm the current vm.
+ * @param budget the maximum number of objects.
+ * @return the number of blackened objects.
+ */
+static uint64_t drain_gray(Vm *vm, uint64_t budget) {
+    uint64_t done = 0;
+
+    while (vm->gray.count > 0 && done < budget) {
+        Object *object = vm->gray.objects[--vm->gray.count];
+
+        // the next object is probably not in the cache anymore, if it was pushed a long time ago
+        if (vm->gray.count > 0) {
+            PREFETCH(vm->gray.objects[vm->gray.count - 1]);
+        }
+
+        blacken(vm, &vm->gray, object);
+        ++done;
+    }
 
-            if (current->type == OBJECT) {
-                mark(current->o_value);
+    return done;
+}
+
+/**
+ * Marks all roots gray.
+ * Constants, shape keys and the single character strings are permanent (see make_permanent), so the only roots are
+ * the global variables and the value stack, which also holds the variables of every active lambda call.
+ * Each of them is scanned exactly once.
+ * @param vm the current vm.
+ * @param gray the gray stack.
+ */
+static void mark_roots(Vm *vm, ObjectArray *gray) {
+    CallFrame *main_frame = vm->frames[0].function;
+
+    mark_values(vm, gray, main_frame->variables.values, main_frame->variables.count);
+    mark_values(vm, gray, vm->stack, (uint64_t) (vm->sp - vm->stack));
+}
+
+static void free_unreached(Vm *vm, Object *unreached) {
+    if (unreached->type == OBJ_STRING && ((ObjString *) unreached)->interned) {
+        // the intern table only holds weak references
+        ObjString *string = (ObjString *) unreached;
+        HTItemKey key;
+        key.key_ident_string = string->chars;
+        key.ident_length = string->length;
+        ht_delete(&vm->strings, key);
+    }
+
+    // TODO don't free referenced elements in list
+    vm->allocated_mem -= free_object(vm, unreached);
+}
+
+/**
+ * Frees all unmarked objects of the young generation and moves the survivors into the old generation.
+ * @param vm the current vm.
+ * @param survivors if not NULL, the survivors are counted by type.
+ */
+static void sweep_young(Vm *vm, uint64_t *survivors) {
+    Object *object = vm->young_objects;
+
+    while (object) {
+        Object *next = object->next;
+
+        if (!object->marked) {
+            free_unreached(vm, object);
+        } else {
+            if (survivors != NULL) {
+                ++survivors[object->type];
             }
+
+            object->next = vm->first_object;
+            vm->first_object = object;
         }
+
+        object = next;
     }
 
-    object->marked = 1;
+    vm->young_objects = NULL;
+    vm->young_mem = 0;
 }
 
-static void mark_all(Vm *vm) {
-    for (int i = vm->frame_count - 1; i >= 0; --i) {
-        CallFrame *curr_frame = vm->frames.frame_pointers[i];
+static void unmark_old(Vm *vm) {
+    for (Object *object = vm->first_object; object != NULL; object = object->next) {
+        object->marked = object->permanent;
+    }
+}
+
+/**
+ * Abandons an unfinished incremental cycle, so that a full collection can start from scratch.
+ * The young objects, that the cycle (or the write barrier) has already marked, are unmarked as well, otherwise the
+ * next collection would consider them live without tracing their references.
+ * @param vm the current vm.
+ */
+static void abort_cycle(Vm *vm) {
+    if (vm->gc_phase != GC_PHASE_CLEARING && vm->gc_phase != GC_PHASE_MARKING) {
+        return;
+    }
+
+    vm->gray.count = 0;
+    vm->clear_cursor = NULL;
+
+    for (Object *object = vm->young_objects; object != NULL; object = object->next) {
+        object->marked = object->permanent;
+    }
+
+    vm->gc_phase = GC_PHASE_IDLE;
+}
+
+static void clear_remembered(Vm *vm) {
+    for (uint64_t i = 0; i < vm->remembered.count; ++i) {
+        vm->remembered.objects[i]->remembered = false;
+    }
+
+    vm->remembered.count = 0;
+}
+
+uint64_t now_ns() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000 + (uint64_t) time.tv_nsec;
+}
+
+// the upper bounds of the buckets of the pause time histogram in nanoseconds (the last bucket has none)
+static const uint64_t pause_limits[GC_PAUSE_BUCKETS - 1] = {
+        100000, 500000, 1000000, 5000000, 10000000, 50000000, 100000000
+};
+
+static const char *const pause_labels[GC_PAUSE_BUCKETS] = {
+        "<0.1ms", "<0.5ms", "<1ms", "<5ms", "<10ms", "<50ms", "<100ms", ">=100ms"
+};
+
+static void record_pause(Vm *vm, uint64_t start) {
+    uint64_t pause = now_ns() - start;
+    vm->cycle_gc_time += pause;
+    vm->stats.total_pause += pause;
+
+    if (pause > vm->stats.max_pause) {
+        vm->stats.max_pause = pause;
+    }
+
+    uint32_t bucket = 0;
+
+    while (bucket < GC_PAUSE_BUCKETS - 1 && pause >= pause_limits[bucket]) {
+        ++bucket;
+    }
+
+    ++vm->stats.pauses[bucket];
+}
+
+void remember_object(Vm *vm, Object *object) {
+    ObjectArray *remembered = &vm->remembered;
+
+    if (remembered->count >= remembered->cap) {
+        remembered->cap = GROW_CAP(remembered->cap);
+        remembered->objects = GROW_ARR(remembered->objects, Object *, remembered->cap);
+    }
+
+    object->remembered = true;
+    remembered->objects[remembered->count++] = object;
+}
+
+void write_barrier_slow(Vm *vm, Object *object, Object *value) {
+    switch (vm->gc_phase) {
+        case GC_PHASE_IDLE:
+        case GC_PHASE_SWEEPING:
+            // old objects are marked, young ones are not
+            if (!object->remembered) {
+                remember_object(vm, object);
+            }
+            break;
+        case GC_PHASE_MARKING:
+            // a black object must never point to a white one
+            mark(vm, &vm->gray, value);
+            break;
+        case GC_PHASE_CLEARING:
+            // nothing has been marked in this cycle yet
+            break;
+    }
+}
+
+typedef struct {
+    GcPool *pool;
+    uint32_t index;
+
+    // gray objects, that only this worker takes from
+    ObjectArray gray;
+    // gray objects, that any worker may steal (protected by lock)
+    ObjectArray shared;
+    pthread_mutex_t lock;
+} GcWorker;
+
+struct gc_pool_t {
+    Vm *vm;
+    // the number of workers including the thread, which started the collection
+    uint32_t count;
+    GcWorker *workers;
+    pthread_t *threads;
+
+    // protects phase, active and shutdown
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finished;
+    // incremented for every mark phase
+    uint64_t phase;
+    // the number of threads, that have not finished the current phase
+    uint32_t active;
+    bool shutdown;
+
+    // the number of workers, that have run out of work (atomic)
+    uint32_t idle;
+};
+
+/**
+ * Moves the oldest half of the gray objects of a worker into its shared queue.
+ * Old gray objects tend to be the roots of large subgraphs, so they are worth stealing.
+ * @param worker the worker.
+ */
+static void share_work(GcWorker *worker) {
+    ObjectArray *shared = &worker->shared;
+    uint64_t half = worker->gray.count / 2;
+
+    pthread_mutex_lock(&worker->lock);
+
+    uint64_t count = shared->count;
+
+    while (count + half > shared->cap) {
+        shared->cap = GROW_CAP(shared->cap);
+        shared->objects = GROW_ARR(shared->objects, Object *, shared->cap);
+    }
+
+    memcpy(shared->objects + count, worker->gray.objects, half * sizeof(Object *));
+
+    // the count is read without holding the lock
+    __atomic_store_n(&shared->count, count + half, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&worker->lock);
+
+    worker->gray.count -= half;
+    memmove(worker->gray.objects, worker->gray.objects + half, worker->gray.count * sizeof(Object *));
+}
+
+/**
+ * Takes half of the shared gray objects of a victim (all of them, if the victim is the worker itself).
+ * @param worker the stealing worker.
+ * @param victim the worker, whose shared queue is emptied.
+ * @return true if any objects were taken.
+ */
+static bool take_shared(GcWorker *worker, GcWorker *victim) {
+    if (__atomic_load_n(&victim->shared.count, __ATOMIC_ACQUIRE) == 0) {
+        return false;
+    }
+
+    pthread_mutex_lock(&victim->lock);
+
+    uint64_t count = victim->shared.count;
+    uint64_t take = victim == worker ? count : (count + 1) / 2;
+
+    for (uint64_t i = 0; i < take; ++i) {
+        push_gray(&worker->gray, victim->shared.objects[--count]);
+    }
+
+    __atomic_store_n(&victim->shared.count, count, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&victim->lock);
+
+    return take > 0;
+}
+
+static bool steal_work(GcWorker *worker) {
+    GcPool *pool = worker->pool;
+
+    // the own queue has to be emptied first, otherwise the work could be lost once every worker is idle
+    for (uint32_t i = 0; i < pool->count; ++i) {
+        GcWorker *victim = &pool->workers[(worker->index + i) % pool->count];
+
+        if (take_shared(worker, victim)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool work_available(GcPool *pool) {
+    for (uint32_t i = 0; i < pool->count; ++i) {
+        if (__atomic_load_n(&pool->workers[i].shared.count, __ATOMIC_ACQUIRE) > 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Marks objects until every worker has run out of work.
+ * @param worker the worker of the calling thread.
+ */
+static void mark_in_parallel(GcWorker *worker) {
+    GcPool *pool = worker->pool;
+    Vm *vm = pool->vm;
+    ObjectArray *gray = &worker->gray;
+
+    for (;;) {
+        while (gray->count > 0) {
+            Object *object = gray->objects[--gray->count];
+
+            if (gray->count > 0) {
+                PREFETCH(gray->objects[gray->count - 1]);
+            }
 
-        // variables
-        for (int j = 0; j < curr_frame->variables.count; ++j) {
-            CrispyValue *value = &curr_frame->variables.values[j];
+            blacken(vm, gray, object);
 
-            // TODO check reason for uinitcondition warning in valgrind
-            if (value->type == OBJECT) {
-                mark(value->o_value);
+            if (gray->count >= GC_SHARE_THRESHOLD && __atomic_load_n(&worker->shared.count, __ATOMIC_RELAXED) == 0) {
+                share_work(worker);
             }
         }
 
-        // constants
-        for (int j = 0; j < curr_frame->constants.count; ++j) {
-            CrispyValue *value = &curr_frame->constants.values[j];
+        if (steal_work(worker)) {
+            continue;
+        }
+
+        // only workers with an empty gray stack count as idle, so marking is done once all of them are
+        __atomic_add_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+
+        for (;;) {
+            if (__atomic_load_n(&pool->idle, __ATOMIC_SEQ_CST) == pool->count) {
+                return;
+            }
 
-            if (value->type == OBJECT) {
-                mark(value->o_value);
+            if (work_available(pool)) {
+                __atomic_sub_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+                break;
             }
+
+            sched_yield();
         }
+    }
+}
+
+static void *gc_thread(void *arg) {
+    GcWorker *worker = arg;
+    GcPool *pool = worker->pool;
+    uint64_t phase = 0;
+
+    pthread_mutex_lock(&pool->lock);
+
+    for (;;) {
+        while (pool->phase == phase && !pool->shutdown) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+
+        if (pool->shutdown) {
+            break;
+        }
+
+        phase = pool->phase;
+        pthread_mutex_unlock(&pool->lock);
+
+        mark_in_parallel(worker);
+
+        pthread_mutex_lock(&pool->lock);
+
+        if (--pool->active == 0) {
+            pthread_cond_signal(&pool->finished);
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static GcPool *new_gc_pool(Vm *vm, uint32_t count) {
+    GcPool *pool = malloc(sizeof(GcPool));
+    pool->vm = vm;
+    pool->count = count;
+    pool->workers = malloc(count * sizeof(GcWorker));
+    pool->threads = malloc((count - 1) * sizeof(pthread_t));
+    pool->phase = 0;
+    pool->active = 0;
+    pool->shutdown = false;
+    pool->idle = 0;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->finished, NULL);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        GcWorker *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        worker->gray = (ObjectArray) {0, 0, NULL};
+        worker->shared = (ObjectArray) {0, 0, NULL};
+        pthread_mutex_init(&worker->lock, NULL);
+    }
+
+    // the thread, which starts a collection, is the first worker
+    for (uint32_t i = 1; i < count; ++i) {
+        if (pthread_create(&pool->threads[i - 1], NULL, gc_thread, &pool->workers[i]) != 0) {
+            fprintf(stderr, "Could not start gc thread\n");
+            exit(-2);
+        }
+    }
+
+    return pool;
+}
+
+void stop_gc_threads(Vm *vm) {
+    GcPool *pool = vm->gc_pool;
+
+    if (pool == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (uint32_t i = 1; i < pool->count; ++i) {
+        pthread_join(pool->threads[i - 1], NULL);
+    }
+
+    for (uint32_t i = 0; i < pool->count; ++i) {
+        FREE_ARR(pool->workers[i].gray.objects);
+        FREE_ARR(pool->workers[i].shared.objects);
+        pthread_mutex_destroy(&pool->workers[i].lock);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->finished);
+
+    free(pool->workers);
+    free(pool->threads);
+    free(pool);
+    vm->gc_pool = NULL;
+}
+
+/**
+ * Marks everything, that is reachable from the roots, with vm->gc_threads threads.
+ * @param vm the current vm.
+ */
+static void mark_all_parallel(Vm *vm) {
+    if (vm->gc_pool != NULL && vm->gc_pool->count != vm->gc_threads) {
+        stop_gc_threads(vm);
+    }
+
+    if (vm->gc_pool == NULL) {
+        vm->gc_pool = new_gc_pool(vm, vm->gc_threads);
+    }
+
+    GcPool *pool = vm->gc_pool;
+    GcWorker *main_worker = &pool->workers[0];
+
+    // the other threads steal the roots from the first worker
+    mark_roots(vm, &main_worker->gray);
+
+    vm->parallel_marking = true;
+    __atomic_store_n(&pool->idle, 0, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_lock(&pool->lock);
+    ++pool->phase;
+    pool->active = pool->count - 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    mark_in_parallel(main_worker);
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (pool->active > 0) {
+        pthread_cond_wait(&pool->finished, &pool->lock);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    vm->parallel_marking = false;
+}
+
+/**
+ * Computes the heap size, at which the next full collection starts, and begins a new cycle.
+ * The heap may grow by the growth factor. If most of the heap survived, the collection was mostly wasted work,
+ * so the heap grows faster. The headroom also has to be large enough, that the program can allocate at its current
+ * rate for a while, before the gc exceeds its share (GC_TARGET_OVERHEAD) of the run time.
+ * @param vm the current vm.
+ * @param heap_before the heap size before the collection.
+ * @param live the size of the surviving objects.
+ */
+static void pace(Vm *vm, size_t heap_before, size_t live) {
+    double survival = heap_before > 0 ? (double) live / heap_before : 0.0;
+    double headroom = live * (vm->heap_growth - 1.0) * (1.0 + survival);
+
+    uint64_t now = now_ns();
+    uint64_t cycle_time = now - vm->cycle_start;
+
+    if (cycle_time > vm->cycle_gc_time) {
+        double allocation_rate = (double) vm->cycle_allocated / (cycle_time - vm->cycle_gc_time);
+        double rate_headroom = allocation_rate * vm->cycle_gc_time / GC_TARGET_OVERHEAD;
+
+        if (rate_headroom > headroom) {
+            headroom = rate_headroom;
+        }
+    }
+
+    size_t threshold = live + (size_t) headroom;
+
+    if (threshold < vm->min_heap) {
+        threshold = vm->min_heap;
+    }
+
+    if (vm->max_heap != 0 && threshold > vm->max_heap) {
+        // if the live objects exceed the maximum, collecting constantly would not help
+        threshold = live < vm->max_heap ? vm->max_heap : live + live / 8;
+    }
+
+    if (threshold > vm->heap_limit) {
+        // reaching the limit causes a full collection anyway
+        threshold = vm->heap_limit;
+    }
+
+    vm->max_alloc_mem = threshold;
+    vm->stats.allocated += vm->cycle_allocated;
+    vm->cycle_start = now;
+    vm->cycle_gc_time = 0;
+    vm->cycle_allocated = 0;
+}
+
+static bool drop_dead_string(CrispyValue value) {
+    ObjString *string = (ObjString *) AS_OBJ(value);
+
+    if (string->object.marked) {
+        return false;
+    }
+
+    // the string might stay in the heap for a while, but it must not be found again
+    string->interned = false;
+    return true;
+}
+
+struct gc_sweeper_t {
+    Vm *vm;
+    pthread_t thread;
+
+    // the objects to sweep, only accessed by the sweeper thread until it is done
+    Object *objects;
+    Object *survivors;
+    Object *last_survivor;
+    size_t freed;
+    uint64_t surviving[OBJECT_TYPE_COUNT];
+
+    // set by the sweeper thread once it has finished (atomic)
+    uint8_t done;
+};
+
+static void *sweep_in_background(void *arg) {
+    GcSweeper *sweeper = arg;
+    Object *object = sweeper->objects;
+
+    while (object) {
+        Object *next = object->next;
 
-        // stack
-        for (int k = 0; k < vm->sp - vm->stack; k++) {
-            if (vm->stack[k].type == OBJECT) {
-                mark(vm->stack[k].o_value);
+        if (!object->marked) {
+            sweeper->freed += free_object(sweeper->vm, object);
+        } else {
+            if (sweeper->survivors == NULL) {
+                sweeper->last_survivor = object;
             }
+
+            ++sweeper->surviving[object->type];
+
+            object->next = sweeper->survivors;
+            sweeper->survivors = object;
         }
+
+        object = next;
+    }
+
+    __atomic_store_n(&sweeper->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void start_background_sweep(Vm *vm) {
+    GcSweeper *sweeper = malloc(sizeof(GcSweeper));
+    sweeper->vm = vm;
+    sweeper->objects = vm->unswept;
+    sweeper->survivors = NULL;
+    sweeper->last_survivor = NULL;
+    sweeper->freed = 0;
+    memset(sweeper->surviving, 0, sizeof(sweeper->surviving));
+    sweeper->done = 0;
+
+    vm->unswept = NULL;
+    vm->sweeper = sweeper;
+
+    // the sweeper returns the dead objects to the slabs, while the program allocates from them
+    slab_set_concurrent(&vm->slabs, true);
+
+    if (pthread_create(&sweeper->thread, NULL, sweep_in_background, sweeper) != 0) {
+        fprintf(stderr, "Could not start sweeper thread\n");
+        exit(-2);
+    }
+}
+
+static void join_background_sweep(Vm *vm) {
+    GcSweeper *sweeper = vm->sweeper;
+    pthread_join(sweeper->thread, NULL);
+
+    slab_set_concurrent(&vm->slabs, false);
+
+    if (sweeper->survivors != NULL) {
+        sweeper->last_survivor->next = vm->first_object;
+        vm->first_object = sweeper->survivors;
     }
+
+    vm->allocated_mem -= sweeper->freed;
+    vm->live_mem -= sweeper->freed;
+
+    for (int i = 0; i < OBJECT_TYPE_COUNT; ++i) {
+        vm->surviving[i] += sweeper->surviving[i];
+    }
+
+    free(sweeper);
+    vm->sweeper = NULL;
 }
 
-static void sweep(Vm *vm) {
-    Object **object = &vm->first_object;
-    while (*object) {
-        if (!(*object)->marked) {
-            Object *unreached = *object;
-            *object = unreached->next;
+/**
+ * Ends a full collection after marking. Dead strings are removed from the intern table and the young generation is
+ * swept right away (it is at most NURSERY_SIZE bytes large). The old generation is swept later.
+ * @param vm the current vm.
+ * @param heap_before the heap size at the start of the collection.
+ */
+static void finish_marking(Vm *vm, size_t heap_before) {
+    uint32_t dropped = ht_delete_if(&vm->strings, drop_dead_string);
+    vm->allocated_mem -= dropped * sizeof(HTItem);
+
+    ++vm->stats.full_collections;
+    memset(vm->surviving, 0, sizeof(vm->surviving));
+
+    vm->unswept = vm->first_object;
+    vm->first_object = NULL;
+    sweep_young(vm, vm->surviving);
+
+    vm->collected_heap = heap_before;
+    vm->live_mem = vm->allocated_mem;
+    vm->gc_phase = GC_PHASE_SWEEPING;
+
+    if (vm->background_sweep) {
+        start_background_sweep(vm);
+    }
+}
 
-            // TODO don't free referenced elements in list
-            vm->allocated_mem -= free_object(unreached);
+static void finish_cycle(Vm *vm) {
+    vm->gc_phase = GC_PHASE_IDLE;
+    pace(vm, vm->collected_heap, vm->live_mem);
+    memcpy(vm->stats.live_objects, vm->surviving, sizeof(vm->surviving));
+
+    // the objects can only be moved, once the interpreter reaches a safe point
+    if (vm->compacting_gc && vm->slabs.slab_count >= COMPACT_MIN_SLABS
+        && slab_fragmentation(&vm->slabs) > COMPACT_FRAGMENTATION) {
+        vm->compaction_requested = true;
+    }
+
+#if DEBUG_TRACE_GC
+    printf("Finished sweeping, %ld bytes survived.\n", vm->live_mem);
+#endif
+}
+
+/**
+ * Sweeps old objects until the budget is used up. Survivors stay marked until the next full collection.
+ * @param vm the current vm.
+ * @param budget the maximum number of objects.
+ */
+static void sweep_old(Vm *vm, uint64_t budget) {
+    for (uint64_t i = 0; i < budget && vm->unswept != NULL; ++i) {
+        Object *object = vm->unswept;
+        vm->unswept = object->next;
+
+        if (!object->marked) {
+            size_t size = free_object(vm, object);
+            vm->allocated_mem -= size;
+            vm->live_mem -= size;
         } else {
-            (*object)->marked = 0;
-            object = &(*object)->next;
+            ++vm->surviving[object->type];
+            object->next = vm->first_object;
+            vm->first_object = object;
         }
     }
 }
 
+void sweep_step(Vm *vm) {
+    if (vm->gc_phase != GC_PHASE_SWEEPING) {
+        return;
+    }
+
+    if (vm->sweeper != NULL) {
+        if (!__atomic_load_n(&vm->sweeper->done, __ATOMIC_ACQUIRE)) {
+            return;
+        }
+
+        join_background_sweep(vm);
+        finish_cycle(vm);
+        return;
+    }
+
+    uint64_t start = now_ns();
+    sweep_old(vm, GC_SWEEP_BUDGET);
+    record_pause(vm, start);
+
+    if (vm->unswept == NULL) {
+        finish_cycle(vm);
+    }
+}
+
+void finish_sweep(Vm *vm) {
+    if (vm->gc_phase != GC_PHASE_SWEEPING) {
+        return;
+    }
+
+    uint64_t start = now_ns();
+
+    if (vm->sweeper != NULL) {
+        join_background_sweep(vm);
+    } else {
+        sweep_old(vm, UINT64_MAX);
+    }
+
+    record_pause(vm, start);
+    finish_cycle(vm);
+}
+
 void gc(Vm *vm) {
+#if DISABLE_GC
+    return;
+#endif
+
+    // the marks of the last collection are still needed to finish its sweep
+    finish_sweep(vm);
+
+    uint64_t start = now_ns();
+    size_t heap_before = vm->allocated_mem;
+
+    // an unfinished incremental cycle is restarted, the old objects are unmarked below
+    abort_cycle(vm);
+
+    // a full collection traces everything, so the remembered set is not needed
+    clear_remembered(vm);
+    unmark_old(vm);
+
+    if (vm->gc_threads > 1) {
+        mark_all_parallel(vm);
+    } else {
+        mark_roots(vm, &vm->gray);
+        drain_gray(vm, UINT64_MAX);
+    }
+
+    finish_marking(vm, heap_before);
+
+    record_pause(vm, start);
+
+#if DEBUG_TRACE_GC
+    printf("Marked the heap, %ld bytes before sweeping.\n", vm->allocated_mem);
+#endif
+}
+
+void full_gc(Vm *vm) {
+    // gc() aborts an incremental cycle, whose marks can't be trusted, and finishes the sweep of the previous one
+    gc(vm);
+    finish_sweep(vm);
+}
+
+void check_heap_limit(Vm *vm, size_t size) {
+    if (vm->heap_limit_handler == NULL || vm->allocated_mem + size <= vm->heap_limit) {
+        vm->heap_limit_exceeded = false;
+        return;
+    }
+
+    if (vm->current_status != VM_STATUS_RUNNING) {
+        // the gc is disabled while native functions run, so the limit is checked again at the next safe point
+        vm->heap_limit_exceeded = true;
+        return;
+    }
+
+    vm->heap_limit_exceeded = false;
+
+    // the heap might consist mostly of garbage
+    full_gc(vm);
+
+    if (vm->allocated_mem + size > vm->heap_limit) {
+        longjmp(*vm->heap_limit_handler, 1);
+    }
+}
+
+void minor_gc(Vm *vm) {
 #if DEBUG_TRACE_GC
     size_t mem_before = vm->allocated_mem;
 #endif
@@ -113,14 +953,331 @@ void gc(Vm *vm) {
     return;
 #endif
 
-    mark_all(vm);
-    sweep(vm);
+    uint64_t start = now_ns();
+
+    // old objects are still marked, so marking stops at them
+    mark_roots(vm, &vm->gray);
+
+    for (uint64_t i = 0; i < vm->remembered.count; ++i) {
+        blacken(vm, &vm->gray, vm->remembered.objects[i]);
+    }
+
+    drain_gray(vm, UINT64_MAX);
+    sweep_young(vm, NULL);
+    ++vm->stats.minor_collections;
+
+    // all young objects are old now, so there are no more references from old to young objects
+    clear_remembered(vm);
+
+    record_pause(vm, start);
+
+#if DEBUG_TRACE_GC
+    printf("Minor collection freed %ld bytes, %ld remaining.\n", mem_before - vm->allocated_mem, vm->allocated_mem);
+#endif
+}
+
+void gc_step(Vm *vm) {
+#if DISABLE_GC
+    return;
+#endif
+
+    uint64_t start = now_ns();
+    uint64_t budget = vm->gc_slice_budget;
+
+    if (vm->gc_phase == GC_PHASE_IDLE) {
+        // the whole heap is traced, so the remembered set is not needed
+        clear_remembered(vm);
+        vm->clear_cursor = vm->first_object;
+        vm->gc_phase = GC_PHASE_CLEARING;
+    }
+
+    if (vm->gc_phase == GC_PHASE_CLEARING) {
+        // the sticky marks of the old generation have to be removed before marking can start
+        while (vm->clear_cursor != NULL && budget > 0) {
+            vm->clear_cursor->marked = vm->clear_cursor->permanent;
+            vm->clear_cursor = vm->clear_cursor->next;
+            --budget;
+        }
+
+        if (vm->clear_cursor == NULL) {
+            vm->gc_phase = GC_PHASE_MARKING;
+            mark_roots(vm, &vm->gray);
+        }
+    }
+
+    if (vm->gc_phase == GC_PHASE_MARKING) {
+        drain_gray(vm, budget);
+
+        if (vm->gray.count == 0) {
+            // the roots are not protected by the write barrier, so they have to be scanned again
+            mark_roots(vm, &vm->gray);
+            drain_gray(vm, UINT64_MAX);
+
+            // objects allocated during the cycle are part of the heap, that was collected
+            finish_marking(vm, vm->allocated_mem);
+
+#if DEBUG_TRACE_GC
+            printf("Finished incremental marking, %ld bytes before sweeping.\n", vm->allocated_mem);
+#endif
+        }
+    }
+
+    record_pause(vm, start);
+}
+
+// the mark of the old cell of a moved object, whose next pointer holds the new address
+#define FORWARDED 2
+
+static inline Object *forward(Object *object) {
+    return object->marked == FORWARDED ? object->next : object;
+}
+
+static void forward_values(CrispyValue *values, uint64_t count) {
+    for (uint64_t i = 0; i < count; ++i) {
+        if (CHECK_OBJ(values[i]) && AS_OBJ(values[i])->marked == FORWARDED) {
+            values[i] = create_object(AS_OBJ(values[i])->next);
+        }
+    }
+}
+
+/**
+ * Replaces the references of an object to moved objects with their new addresses.
+ * Updating a reference twice does nothing, so buffers shared by multiple objects are no problem.
+ * @param object the object.
+ */
+static void forward_references(Object *object) {
+    switch (object->type) {
+        case OBJ_DICT: {
+            ObjDict *dict = (ObjDict *) object;
+
+            if (dict->shape != NULL) {
+                forward_values(dict->slots, dict->shape->slot_count);
+                return;
+            }
+
+            ht_relocate(&dict->content);
+
+            for (int i = 0; i < dict->content.cap; ++i) {
+                for (HTItem *current = dict->content.buckets[i]; current != NULL; current = current->next) {
+                    current->key.key_obj_string = (ObjString *) forward((Object *) current->key.key_obj_string);
+                    forward_values(&current->value, 1);
+                }
+            }
+            return;
+        }
+        case OBJ_LIST: {
+            ObjList *list = (ObjList *) object;
+
+            if (list->storage == LIST_GENERIC) {
+                forward_values(list->content.values, list->content.count);
+            } else if (list->storage == LIST_PERSISTENT) {
+                if (list->vector.root != NULL) {
+                    list->vector.root = (ObjVectorNode *) forward((Object *) list->vector.root);
+                }
+
+                forward_values(list->vector.tail, list->vector.tail_count);
+            }
+            return;
+        }
+        case OBJ_VECTOR_NODE:
+            forward_values(((ObjVectorNode *) object)->items, VECTOR_WIDTH);
+            return;
+        case OBJ_SLICE: {
+            ObjSlice *slice = (ObjSlice *) object;
+            slice->parent = forward(slice->parent);
+            return;
+        }
+        case OBJ_ROPE: {
+            ObjRope *rope = (ObjRope *) object;
+
+            if (rope->left != NULL) {
+                rope->left = forward(rope->left);
+                rope->right = forward(rope->right);
+            }
+            return;
+        }
+        case OBJ_LAMBDA: {
+            CallFrame *frame = ((ObjLambda *) object)->call_frame;
+
+            if (frame != NULL) {
+                forward_values(frame->constants.values, frame->constants.count);
+            }
+            return;
+        }
+        default:
+            return;
+    }
+}
+
+static void forward_shape(Shape *shape) {
+    if (shape->key != NULL) {
+        shape->key = (ObjString *) forward((Object *) shape->key);
+    }
+
+    for (uint32_t i = 0; i < shape->slot_count; ++i) {
+        shape->keys[i] = (ObjString *) forward((Object *) shape->keys[i]);
+    }
+
+    for (Shape *child = shape->first_child; child != NULL; child = child->next_sibling) {
+        forward_shape(child);
+    }
+}
+
+/**
+ * Updates every reference to a moved object, that is not stored inside another object.
+ * @param vm the current vm.
+ */
+static void forward_roots(Vm *vm) {
+    forward_shape(vm->root_shape);
+
+    for (int i = 0; i < 256; ++i) {
+        vm->single_chars[i] = (ObjString *) forward((Object *) vm->single_chars[i]);
+    }
+
+    CallFrame *main_frame = vm->frames[0].function;
+    forward_values(main_frame->variables.values, main_frame->variables.count);
+
+    for (int i = vm->frame_count - 1; i >= 0; --i) {
+        CallFrame *curr_frame = vm->frames[i].function;
+        forward_values(curr_frame->constants.values, curr_frame->constants.count);
+    }
+
+    forward_values(vm->stack, (uint64_t) (vm->sp - vm->stack));
+
+    for (uint64_t i = 0; i < vm->remembered.count; ++i) {
+        vm->remembered.objects[i] = forward(vm->remembered.objects[i]);
+    }
+
+    // the keys of the intern table point into the characters of the strings
+    ht_relocate(&vm->strings);
+
+    for (uint32_t i = 0; i < vm->strings.cap; ++i) {
+        for (HTItem *current = vm->strings.buckets[i]; current != NULL; current = current->next) {
+            ObjString *string = (ObjString *) forward(AS_OBJ(current->value));
+            current->value = create_object((Object *) string);
+            current->key.key_ident_string = string->chars;
+        }
+    }
+}
+
+/**
+ * Moves all objects of a generation, which are part of an evacuated slab, into other slabs.
+ * The old cells are forwarded to the copies and collected in an array.
+ * @param vm the current vm.
+ * @param generation the first object of the generation.
+ * @param moved the array of old cells.
+ */
+static void evacuate(Vm *vm, Object **generation, ObjectArray *moved) {
+    Object **link = generation;
+    Object *object = *generation;
+
+    while (object) {
+        Object *next = object->next;
+        size_t size = allocation_size(object);
+
+        if (slab_evacuating(object, size)) {
+            Object *copy = slab_alloc(&vm->slabs, size);
+            memcpy(copy, object, size);
+
+            object->marked = FORWARDED;
+            object->next = copy;
+            push_gray(moved, object);
+            object = copy;
+        }
+
+        *link = object;
+        link = &object->next;
+        object = next;
+    }
+
+    *link = NULL;
+}
+
+void compact_heap(Vm *vm) {
+#if DISABLE_GC
+    return;
+#endif
+
+    // an unfinished sweep still needs the old objects in their places
+    finish_sweep(vm);
+
+    if (vm->gc_phase != GC_PHASE_IDLE) {
+        // the gray stack of an incremental collection is not updated, so the compaction has to wait
+        return;
+    }
+
+    vm->compaction_requested = false;
+
+    uint64_t start = now_ns();
+
+    if (slab_begin_evacuation(&vm->slabs, 1.0 - COMPACT_FRAGMENTATION) == 0) {
+        record_pause(vm, start);
+        return;
+    }
+
+    // the gray stack is not used while the gc is idle
+    ObjectArray *moved = &vm->gray;
+
+    evacuate(vm, &vm->first_object, moved);
+    evacuate(vm, &vm->young_objects, moved);
+
+    // young objects might be unreachable, but everything they reference still exists
+    forward_roots(vm);
+
+    for (Object *object = vm->first_object; object != NULL; object = object->next) {
+        forward_references(object);
+    }
+
+    for (Object *object = vm->young_objects; object != NULL; object = object->next) {
+        forward_references(object);
+    }
+
+    for (uint64_t i = 0; i < moved->count; ++i) {
+        slab_free(&vm->slabs, moved->objects[i], allocation_size(moved->objects[i]));
+    }
 
-    vm->max_alloc_mem = vm->allocated_mem * 2;
+    moved->count = 0;
+    slab_end_evacuation(&vm->slabs);
+    ++vm->stats.compactions;
+
+    record_pause(vm, start);
 
 #if DEBUG_TRACE_GC
-    printf("Collected %ld bytes, %ld remaining.\n", mem_before - vm->allocated_mem, vm->allocated_mem);
+    printf("Compacted the heap into %ld slabs.\n", vm->slabs.slab_count);
 #endif
 }
 
+void gc_stats(Vm *vm, GcStats *stats) {
+    *stats = vm->stats;
+
+    // everything, that is not part of the heap anymore, has been freed
+    stats->allocated += vm->cycle_allocated;
+    stats->freed = stats->allocated > vm->allocated_mem ? stats->allocated - vm->allocated_mem : 0;
+    stats->heap = vm->allocated_mem;
+}
+
+const char *gc_pause_label(uint32_t bucket) {
+    return bucket < GC_PAUSE_BUCKETS ? pause_labels[bucket] : NULL;
+}
+
+void print_gc_stats(Vm *vm) {
+    GcStats stats;
+    gc_stats(vm, &stats);
 
+    fprintf(stderr, "GC statistics:\n");
+    fprintf(stderr, "  full collections:  %lu (%lu compactions)\n", stats.full_collections, stats.compactions);
+    fprintf(stderr, "  minor collections: %lu\n", stats.minor_collections);
+    fprintf(stderr, "  allocated: %zu bytes, freed: %zu bytes, heap: %zu bytes\n",
+            stats.allocated, stats.freed, stats.heap);
+    fprintf(stderr, "  live objects after the last full collection:\n");
+
+    for (int i = 0; i < OBJECT_TYPE_COUNT; ++i) {
+        fprintf(stderr, "    %-12s %lu\n", object_type_name((ObjectType) i), stats.live_objects[i]);
+    }
+
+    fprintf(stderr, "  pauses: %.3f ms in total, %.3f ms at most\n", stats.total_pause / 1e6, stats.max_pause / 1e6);
+
+    for (uint32_t i = 0; i < GC_PAUSE_BUCKETS; ++i) {
+        fprintf(stderr, "    %-12s %lu\n", pause_labels[i], stats.pauses[i]);
+    }
+}
@@ -7,12 +7,25 @@
 #define MEMORY_H
 
 #include <stdlib.h>
+#include <stdint.h>
 
 #define GROW_CAP(old_cap) (old_cap) < 8 ? 8 : ((old_cap) * 2)
 #define FREE_ARR(previous) reallocate(previous, 0)
 #define GROW_ARR(previous, type, new_cap) \
         reallocate(previous, sizeof(type) * (new_cap))
 
+#if defined(__GNUC__)
+#define PREFETCH(address) __builtin_prefetch(address)
+#else
+#define PREFETCH(address) ((void) 0)
+#endif
+
 void *reallocate(void *previous, size_t size);
 
+/**
+ * Reads the monotonic clock, that is used to measure the gc.
+ * @return the current time in nanoseconds.
+ */
+uint64_t now_ns();
+
 #endif
\ No newline at end of file
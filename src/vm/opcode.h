@@ -55,6 +55,8 @@ typedef enum {
     OP_STRUCT_SET,      // set an element in a data structure (list or dict) at an index
     OP_STRUCT_GET,      // get an element from a data structure (list or dict)
     OP_STRUCT_PEEK,     // peeks key on top of stack and tries to retrieve a value from the dict or list below
+    OP_GET_FIELD,       // get a field with a constant key from a dict index: (keybyte1 << 8) | keybyte2, (cachebyte1 << 8) | cachebyte2
+    OP_SET_FIELD,       // set a field with a constant key in a dict index: (keybyte1 << 8) | keybyte2, (cachebyte1 << 8) | cachebyte2
 
     OP_JMP,             // unconditional jump
     OP_JEQ,             // jump if equals
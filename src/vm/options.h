@@ -6,16 +6,91 @@
 #ifndef CALC_PARAMETERS_H
 #define CALC_PARAMETERS_H
 
+// check the stack pointer before every instruction (release builds, which define NDEBUG, skip the check)
+#ifdef NDEBUG
+#define DEBUG_TYPE_CHECK 0
+#else
 #define DEBUG_TYPE_CHECK 1
+#endif
 #define DEBUG_TRACE_GC 0
 #define DEBUG_TRACE_EXECUTION 0
 #define DEBUG_SHOW_DISASSEMBLY 0
 
-// 1 MB
-#define INITIAL_GC_THRESHOLD 1048576
+// dispatch instructions through a table of label addresses (a GCC extension, also supported by Clang)
+// instead of a switch statement
+#if defined(__GNUC__)
+#define THREADED_DISPATCH 1
+#else
+#define THREADED_DISPATCH 0
+#endif
+
+// pack every value into a single 64 bit word instead of a tagged struct
+#define NAN_BOXING 1
+
+// intern every runtime string on creation (1)
+// or only when it is first used as a dictionary key (0)
+#define INTERN_ON_CREATION 0
+
+// concatenations shorter than this are copied instead of creating a rope
+#define MIN_ROPE_LENGTH 32
+
+// substrings shorter than this are copied instead of creating a slice
+#define MIN_SLICE_LENGTH 16
+
+// dictionaries with more keys than this switch from their shape to a hash table
+#define MAX_SHAPE_SLOTS 32
+
+// the first full collection starts at this heap size and the threshold never gets lower (1 MB)
+#define MIN_HEAP 1048576
+// the threshold for full collections never gets higher than this (0 means no maximum)
+#define MAX_HEAP 0
+// the program stops with a runtime error, if the heap can't be kept below this size (0 means no limit)
+#define HEAP_LIMIT 0
+// the heap may grow by this factor between full collections
+#define HEAP_GROWTH 2.0
+// the pacer lets the heap grow faster, if the gc takes more than this fraction of the run time
+#define GC_TARGET_OVERHEAD 0.1
+// a minor collection is performed every time this many bytes have been allocated (256 KB)
+#define NURSERY_SIZE 262144
+// the default for full collections: incremental (1) or stop the world (0)
+#define INCREMENTAL_GC 0
+// the default number of objects, that an incremental collection processes per allocation
+#define GC_SLICE_BUDGET 256
+// how many values ahead the marker prefetches the referenced objects
+#define GC_PREFETCH_DISTANCE 8
+// the number of old objects, that are swept per allocation after a full collection
+#define GC_SWEEP_BUDGET 128
+// the default for sweeping: on a separate thread (1) or during allocations (0)
+#define BACKGROUND_SWEEP 0
+// the default number of threads, that mark the heap during full collections
+#define GC_THREADS 1
+#define GC_MAX_THREADS 256
+// a marking thread lets the others steal half of its gray objects, once it holds this many
+#define GC_SHARE_THRESHOLD 64
+// the default for compaction: automatically (1) or only on request (0)
+#define COMPACTING_GC 0
+// full collections request a compaction, if more than this fraction of the slab memory is unused.
+// The compaction evacuates the slabs, which have more unused memory than this
+#define COMPACT_FRAGMENTATION 0.5
+// heaps with fewer slabs are never compacted automatically
+#define COMPACT_MIN_SLABS 16
 #define DISABLE_GC 0
 
-#define STACK_MAX 256
+// objects are allocated from aligned blocks of this size (64 KB), which are divided into cells of equal size
+#define SLAB_SIZE 65536
+// cell sizes are multiples of this
+#define SLAB_GRANULARITY 16
+// larger blocks are allocated with malloc
+#define SLAB_MAX_CELL 512
+
+// the size of the value stack, which also holds the variables of lambdas
+#define STACK_MAX 262144
+// the maximum depth of nested calls
+#define FRAMES_MAX 65536
+// a call fails with a stack overflow, if less than this many values would be left for its temporaries
+#define FRAME_STACK_RESERVE 256
 #define SCOPES_MAX 256
+// the compiler allocates its scopes from chunks of this size
+#define ARENA_CHUNK_SIZE 4096
 
 #endif //CALC_PARAMETERS_H
@@ -0,0 +1,109 @@
+// Copyright (c) 2018 Felix Schoeller
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+
+#include <string.h>
+
+#include "shape.h"
+#include "memory.h"
+
+static Shape *new_shape(Shape *parent, ObjString *key) {
+    Shape *shape = malloc(sizeof(Shape));
+    shape->parent = parent;
+    shape->key = key;
+    shape->first_child = NULL;
+    shape->next_sibling = NULL;
+
+    if (parent == NULL) {
+        shape->slot_count = 0;
+        shape->keys = NULL;
+        return shape;
+    }
+
+    // shapes are never freed, so their keys have to stay alive as well
+    make_permanent((Object *) key);
+
+    shape->slot_count = parent->slot_count + 1;
+    shape->keys = malloc(shape->slot_count * sizeof(ObjString *));
+
+    // the root shape has no keys
+    if (parent->slot_count > 0) {
+        memcpy(shape->keys, parent->keys, parent->slot_count * sizeof(ObjString *));
+    }
+
+    shape->keys[parent->slot_count] = key;
+
+    return shape;
+}
+
+Shape *new_root_shape() {
+    return new_shape(NULL, NULL);
+}
+
+void shape_free(Shape *shape) {
+    Shape *child = shape->first_child;
+
+    while (child) {
+        Shape *next = child->next_sibling;
+        shape_free(child);
+        child = next;
+    }
+
+    free(shape->keys);
+    free(shape);
+}
+
+int64_t shape_find_slot(Shape *shape, ObjString *key) {
+    // all keys are interned, so they can be compared by identity
+    for (uint32_t i = 0; i < shape->slot_count; ++i) {
+        if (shape->keys[i] == key) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+Shape *shape_transition(Shape *shape, ObjString *key) {
+    Shape *child = shape->first_child;
+
+    while (child) {
+        if (child->key == key) {
+            return child;
+        }
+
+        child = child->next_sibling;
+    }
+
+    child = new_shape(shape, key);
+    child->next_sibling = shape->first_child;
+    shape->first_child = child;
+
+    return child;
+}
+
+void cache_arr_init(CacheArray *cache_array) {
+    cache_array->cap = 0;
+    cache_array->count = 0;
+    cache_array->caches = NULL;
+}
+
+void cache_arr_free(CacheArray *cache_array) {
+    FREE_ARR(cache_array->caches);
+    cache_arr_init(cache_array);
+}
+
+uint32_t add_inline_cache(CacheArray *cache_array) {
+    if (cache_array->count >= cache_array->cap) {
+        cache_array->cap = GROW_CAP(cache_array->cap);
+        cache_array->caches = GROW_ARR(cache_array->caches, InlineCache, cache_array->cap);
+    }
+
+    InlineCache *cache = &cache_array->caches[cache_array->count];
+    cache->shape = NULL;
+    cache->transition = NULL;
+    cache->slot = 0;
+
+    return (uint32_t) cache_array->count++;
+}
@@ -0,0 +1,82 @@
+// Copyright (c) 2018 Felix Schoeller
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+
+#ifndef CRISPY_SHAPE_H
+#define CRISPY_SHAPE_H
+
+#include "value.h"
+
+/*
+ * A shape (hidden class) describes the keys of a dictionary and the slot, in which the value of each key is stored.
+ * Dictionaries, which get the same keys in the same order, share the same shape.
+ * All shapes form a tree, which starts at the (empty) root shape. Adding a key to a dictionary moves it
+ * to a child of its current shape (transition).
+ * Shapes are owned by the vm and are only freed together with it.
+ */
+typedef struct shape_t {
+    struct shape_t *parent;
+
+    // the key, which was added by the transition from the parent (NULL for the root)
+    ObjString *key;
+    // keys[i] is the (interned) key stored in slot i
+    ObjString **keys;
+    uint32_t slot_count;
+
+    // linked list of all transitions from this shape
+    struct shape_t *first_child;
+    struct shape_t *next_sibling;
+} Shape;
+
+/*
+ * Caches the result of a lookup at a single field access in the bytecode.
+ */
+struct inline_cache_t {
+    // the shape of the dictionary for which the cache was filled (NULL if the cache is empty)
+    Shape *shape;
+    // the shape after the key was added (NULL if the key already existed)
+    Shape *transition;
+    uint32_t slot;
+};
+
+/**
+ * Creates a new root shape without any keys.
+ * @return the shape.
+ */
+Shape *new_root_shape();
+
+/**
+ * Frees a shape and all of its transitions.
+ * @param shape the shape.
+ */
+void shape_free(Shape *shape);
+
+/**
+ * Searches the slot of a key.
+ * @param shape the shape.
+ * @param key the interned key.
+ * @return the slot or -1 if the shape does not contain the key.
+ */
+int64_t shape_find_slot(Shape *shape, ObjString *key);
+
+/**
+ * Returns the shape which has all keys of shape followed by key. The transition is created if necessary.
+ * @param shape the shape.
+ * @param key the interned key, that is not yet part of shape.
+ * @return the new shape.
+ */
+Shape *shape_transition(Shape *shape, ObjString *key);
+
+void cache_arr_init(CacheArray *cache_array);
+
+void cache_arr_free(CacheArray *cache_array);
+
+/**
+ * Adds an empty inline cache.
+ * @param cache_array the cache array.
+ * @return the index of the new cache.
+ */
+uint32_t add_inline_cache(CacheArray *cache_array);
+
+#endif //CRISPY_SHAPE_H
@@ -0,0 +1,271 @@
+// Copyright (c) 2018 Felix Schoeller
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "slab.h"
+
+// the first cell starts after the header, aligned to the granularity
+#define FIRST_CELL_OFFSET ((sizeof(Slab) + SLAB_GRANULARITY - 1) / SLAB_GRANULARITY * SLAB_GRANULARITY)
+// the number of bytes in a slab, that can be used for cells
+#define SLAB_USABLE (SLAB_SIZE - FIRST_CELL_OFFSET)
+
+static inline size_t cell_size(uint32_t size_class) {
+    return (size_class + 1) * SLAB_GRANULARITY;
+}
+
+static void unlink_slab(Slab **list, Slab *slab) {
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+
+    slab->prev = NULL;
+    slab->next = NULL;
+}
+
+static void push_slab(Slab **list, Slab *slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+
+    if (*list != NULL) {
+        (*list)->prev = slab;
+    }
+
+    *list = slab;
+}
+
+static Slab *new_slab(SlabAllocator *allocator, uint32_t size_class) {
+    void *memory;
+
+    if (posix_memalign(&memory, SLAB_SIZE, SLAB_SIZE) != 0) {
+        fprintf(stderr, "Out of memory\n");
+        exit(-2);
+    }
+
+    Slab *slab = memory;
+    slab->size_class = size_class;
+    slab->live = 0;
+    slab->available = true;
+    slab->evacuating = false;
+    slab->free_cells = NULL;
+    slab->bump = (char *) memory + FIRST_CELL_OFFSET;
+    slab->end = (char *) memory + SLAB_SIZE;
+
+    push_slab(&allocator->available[size_class], slab);
+    ++allocator->slab_count;
+
+    return slab;
+}
+
+static Slab **slab_list(SlabAllocator *allocator, Slab *slab) {
+    if (slab->evacuating) {
+        return &allocator->evacuating;
+    }
+
+    return slab->available ? &allocator->available[slab->size_class] : &allocator->full[slab->size_class];
+}
+
+static void release_slab(SlabAllocator *allocator, Slab *slab) {
+    unlink_slab(slab_list(allocator, slab), slab);
+    --allocator->slab_count;
+    free(slab);
+}
+
+void slab_init(SlabAllocator *allocator) {
+    for (uint32_t i = 0; i < SLAB_CLASS_COUNT; ++i) {
+        allocator->available[i] = NULL;
+        allocator->full[i] = NULL;
+    }
+
+    allocator->slab_count = 0;
+    allocator->used = 0;
+    allocator->evacuating = NULL;
+    allocator->concurrent = false;
+    pthread_mutex_init(&allocator->lock, NULL);
+}
+
+void slab_set_concurrent(SlabAllocator *allocator, bool concurrent) {
+    allocator->concurrent = concurrent;
+}
+
+void slab_free_all(SlabAllocator *allocator) {
+    for (uint32_t i = 0; i < SLAB_CLASS_COUNT; ++i) {
+        while (allocator->available[i] != NULL) {
+            release_slab(allocator, allocator->available[i]);
+        }
+
+        while (allocator->full[i] != NULL) {
+            release_slab(allocator, allocator->full[i]);
+        }
+    }
+
+    while (allocator->evacuating != NULL) {
+        release_slab(allocator, allocator->evacuating);
+    }
+
+    pthread_mutex_destroy(&allocator->lock);
+}
+
+static void *alloc_cell(SlabAllocator *allocator, size_t size) {
+    uint32_t size_class = (uint32_t) ((size - 1) / SLAB_GRANULARITY);
+    Slab *slab = allocator->available[size_class];
+
+    if (slab == NULL) {
+        slab = new_slab(allocator, size_class);
+    }
+
+    void *cell;
+    size_t cell_bytes = cell_size(size_class);
+
+    if (slab->free_cells != NULL) {
+        cell = slab->free_cells;
+        slab->free_cells = *(void **) cell;
+    } else {
+        cell = slab->bump;
+        slab->bump += cell_bytes;
+    }
+
+    ++slab->live;
+    allocator->used += cell_bytes;
+
+    if (slab->free_cells == NULL && slab->bump + cell_bytes > slab->end) {
+        unlink_slab(&allocator->available[size_class], slab);
+        push_slab(&allocator->full[size_class], slab);
+        slab->available = false;
+    }
+
+    return cell;
+}
+
+static void free_cell(SlabAllocator *allocator, void *block) {
+    Slab *slab = (Slab *) ((uintptr_t) block & ~((uintptr_t) SLAB_SIZE - 1));
+    uint32_t size_class = slab->size_class;
+
+    *(void **) block = slab->free_cells;
+    slab->free_cells = block;
+    --slab->live;
+    allocator->used -= cell_size(size_class);
+
+    // evacuated slabs are released all at once, when the evacuation ends
+    if (slab->evacuating) {
+        return;
+    }
+
+    if (!slab->available) {
+        unlink_slab(&allocator->full[size_class], slab);
+        push_slab(&allocator->available[size_class], slab);
+        slab->available = true;
+    }
+
+    // the last slab of a class is kept, so that a single object doesn't allocate and release a slab every time
+    if (slab->live == 0 && (slab->prev != NULL || slab->next != NULL)) {
+        release_slab(allocator, slab);
+    }
+}
+
+void *slab_alloc(SlabAllocator *allocator, size_t size) {
+    if (size > SLAB_MAX_CELL) {
+        return malloc(size);
+    }
+
+    if (!allocator->concurrent) {
+        return alloc_cell(allocator, size);
+    }
+
+    pthread_mutex_lock(&allocator->lock);
+    void *cell = alloc_cell(allocator, size);
+    pthread_mutex_unlock(&allocator->lock);
+
+    return cell;
+}
+
+void slab_free(SlabAllocator *allocator, void *block, size_t size) {
+    if (size > SLAB_MAX_CELL) {
+        free(block);
+        return;
+    }
+
+    if (!allocator->concurrent) {
+        free_cell(allocator, block);
+        return;
+    }
+
+    pthread_mutex_lock(&allocator->lock);
+    free_cell(allocator, block);
+    pthread_mutex_unlock(&allocator->lock);
+}
+
+double slab_fragmentation(SlabAllocator *allocator) {
+    if (allocator->slab_count == 0) {
+        return 0.0;
+    }
+
+    return 1.0 - (double) allocator->used / ((double) allocator->slab_count * SLAB_USABLE);
+}
+
+size_t slab_begin_evacuation(SlabAllocator *allocator, double max_occupancy) {
+    size_t selected = 0;
+
+    for (uint32_t i = 0; i < SLAB_CLASS_COUNT; ++i) {
+        uint32_t cells_per_slab = (uint32_t) (SLAB_USABLE / cell_size(i));
+        uint32_t max_live = (uint32_t) (max_occupancy * cells_per_slab);
+        size_t sparse = 0;
+        size_t sparse_live = 0;
+
+        // full slabs can't be sparse
+        for (Slab *slab = allocator->available[i]; slab != NULL; slab = slab->next) {
+            if (slab->live < max_live) {
+                ++sparse;
+                sparse_live += slab->live;
+            }
+        }
+
+        // the cells have to go somewhere, in the worst case into new slabs
+        if (sparse <= (sparse_live + cells_per_slab - 1) / cells_per_slab) {
+            continue;
+        }
+
+        Slab *slab = allocator->available[i];
+
+        while (slab != NULL) {
+            Slab *next = slab->next;
+
+            if (slab->live < max_live) {
+                unlink_slab(&allocator->available[i], slab);
+                slab->evacuating = true;
+                push_slab(&allocator->evacuating, slab);
+                ++selected;
+            }
+
+            slab = next;
+        }
+    }
+
+    return selected;
+}
+
+void slab_end_evacuation(SlabAllocator *allocator) {
+    while (allocator->evacuating != NULL) {
+        Slab *slab = allocator->evacuating;
+
+        if (slab->live == 0) {
+            release_slab(allocator, slab);
+            continue;
+        }
+
+        // cells, that could not be moved (e.g. hash table items), keep the slab alive
+        unlink_slab(&allocator->evacuating, slab);
+        slab->evacuating = false;
+        slab->available = slab->free_cells != NULL || slab->bump + cell_size(slab->size_class) <= slab->end;
+        push_slab(slab->available ? &allocator->available[slab->size_class] : &allocator->full[slab->size_class], slab);
+    }
+}
@@ -0,0 +1,125 @@
+// Copyright (c) 2018 Felix Schoeller
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+
+#ifndef CRISPY_SLAB_H
+#define CRISPY_SLAB_H
+
+#include <pthread.h>
+
+#include "../util/common.h"
+#include "options.h"
+
+#define SLAB_CLASS_COUNT (SLAB_MAX_CELL / SLAB_GRANULARITY)
+
+/*
+ * A block of SLAB_SIZE bytes (aligned to its size), that is divided into cells of a single size class.
+ * The header is stored at the start of the block, so the slab of any cell can be found by masking its address.
+ */
+typedef struct slab_t {
+    // the list (available or full) this slab is part of
+    struct slab_t *prev;
+    struct slab_t *next;
+
+    uint32_t size_class;
+    uint32_t live;
+    bool available;
+    // the objects of this slab are being moved elsewhere (see slab_begin_evacuation)
+    bool evacuating;
+
+    // linked list of freed cells
+    void *free_cells;
+    // cells after this pointer have never been used
+    char *bump;
+    char *end;
+} Slab;
+
+/*
+ * Allocates small, fixed size memory blocks (objects, hash table items, call frames) from slabs.
+ * Blocks larger than SLAB_MAX_CELL are passed on to malloc.
+ */
+typedef struct {
+    // slabs with at least one free cell
+    Slab *available[SLAB_CLASS_COUNT];
+    Slab *full[SLAB_CLASS_COUNT];
+
+    size_t slab_count;
+    // the bytes of all cells in use
+    size_t used;
+
+    // slabs, that are being evacuated (not part of available or full)
+    Slab *evacuating;
+
+    // set while another thread frees blocks (see background sweeping), every operation takes the lock then
+    bool concurrent;
+    pthread_mutex_t lock;
+} SlabAllocator;
+
+void slab_init(SlabAllocator *allocator);
+
+/**
+ * Switches between single threaded use and use by multiple threads.
+ * Must not be called while another thread uses the allocator.
+ * @param allocator the allocator.
+ * @param concurrent true if the allocator is about to be shared.
+ */
+void slab_set_concurrent(SlabAllocator *allocator, bool concurrent);
+
+/**
+ * Releases all slabs, even if they still contain cells in use.
+ * @param allocator the allocator.
+ */
+void slab_free_all(SlabAllocator *allocator);
+
+/**
+ * Allocates a block of memory.
+ * @param allocator the allocator.
+ * @param size the size in bytes (greater than 0).
+ * @return a pointer to the block.
+ */
+void *slab_alloc(SlabAllocator *allocator, size_t size);
+
+/**
+ * Returns a block of memory to its slab. Slabs without any used cells are released.
+ * @param allocator the allocator.
+ * @param block the block.
+ * @param size the size, that was passed to slab_alloc.
+ */
+void slab_free(SlabAllocator *allocator, void *block, size_t size);
+
+/**
+ * Computes the fraction of the slab memory, which is not used by any cell.
+ * @param allocator the allocator.
+ * @return a number between 0 and 1.
+ */
+double slab_fragmentation(SlabAllocator *allocator);
+
+/**
+ * Selects the slabs, whose cells should be moved elsewhere, because they are mostly empty.
+ * A size class is only evacuated, if this frees at least one slab. Until slab_end_evacuation is called,
+ * the selected slabs are not used for new allocations.
+ * @param allocator the allocator.
+ * @param max_occupancy slabs, which are used less than this fraction, are selected.
+ * @return the number of selected slabs.
+ */
+size_t slab_begin_evacuation(SlabAllocator *allocator, double max_occupancy);
+
+/**
+ * Checks if a block is part of a slab, that is being evacuated.
+ * @param block the block.
+ * @param size the size, that was passed to slab_alloc.
+ * @return true if the block should be moved.
+ */
+static inline bool slab_evacuating(void *block, size_t size) {
+    // larger blocks are not part of any slab
+    return size <= SLAB_MAX_CELL && ((Slab *) ((uintptr_t) block & ~((uintptr_t) SLAB_SIZE - 1)))->evacuating;
+}
+
+/**
+ * Releases the evacuated slabs. Slabs, that still contain cells in use, become available again.
+ * @param allocator the allocator.
+ */
+void slab_end_evacuation(SlabAllocator *allocator);
+
+#endif //CRISPY_SLAB_H
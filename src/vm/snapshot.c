@@ -0,0 +1,289 @@
+// Copyright (c) 2018 Felix Schoeller
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "snapshot.h"
+#include "memory.h"
+#include "dictionary.h"
+#include "list.h"
+
+// the number of characters of a string, that are written as its preview
+#define PREVIEW_LENGTH 32
+
+/*
+ * A set of object pointers (open addressing with linear probing).
+ */
+typedef struct {
+    uint64_t cap;
+    uint64_t count;
+    Object **objects;
+} ObjectSet;
+
+typedef struct {
+    Vm *vm;
+    FILE *file;
+
+    // the objects, that have already been written
+    ObjectSet written;
+    // written objects, whose references have not been written yet
+    ObjectArray pending;
+} Snapshot;
+
+static inline uint64_t hash_pointer(Object *object, uint64_t cap) {
+    // objects are aligned, so the lowest bits are always the same
+    uint64_t x = (uint64_t) (uintptr_t) object >> 4;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+
+    return x & (cap - 1);
+}
+
+static void set_insert(ObjectSet *set, Object *object, uint64_t index) {
+    set->objects[index] = object;
+    ++set->count;
+}
+
+static void set_grow(ObjectSet *set) {
+    uint64_t old_cap = set->cap;
+    Object **old_objects = set->objects;
+
+    set->cap = GROW_CAP(old_cap);
+    set->count = 0;
+    set->objects = calloc(set->cap, sizeof(Object *));
+
+    for (uint64_t i = 0; i < old_cap; ++i) {
+        if (old_objects[i] == NULL) {
+            continue;
+        }
+
+        uint64_t index = hash_pointer(old_objects[i], set->cap);
+
+        while (set->objects[index] != NULL) {
+            index = (index + 1) & (set->cap - 1);
+        }
+
+        set_insert(set, old_objects[i], index);
+    }
+
+    free(old_objects);
+}
+
+/**
+ * Adds an object to a set.
+ * @param set the set.
+ * @param object the object.
+ * @return true if the object was not part of the set before.
+ */
+static bool set_add(ObjectSet *set, Object *object) {
+    // the load factor is kept below 1/2
+    if ((set->count + 1) * 2 > set->cap) {
+        set_grow(set);
+    }
+
+    uint64_t index = hash_pointer(object, set->cap);
+
+    while (set->objects[index] != NULL) {
+        if (set->objects[index] == object) {
+            return false;
+        }
+
+        index = (index + 1) & (set->cap - 1);
+    }
+
+    set_insert(set, object, index);
+    return true;
+}
+
+static void write_preview(Snapshot *snapshot, Object *object) {
+    FILE *file = snapshot->file;
+    const char *chars = NULL;
+    size_t length = 0;
+
+    switch (object->type) {
+        case OBJ_STRING:
+        case OBJ_SLICE:
+            // the parent of a slice is always flat, so nothing is flattened here
+            chars = string_chars(snapshot->vm, object);
+            length = string_length(object);
+            break;
+        case OBJ_ROPE:
+            // taking a snapshot must not flatten ropes
+            chars = ((ObjRope *) object)->flat;
+            length = chars != NULL ? string_length(object) : 0;
+            break;
+        default:
+            return;
+    }
+
+    if (length > PREVIEW_LENGTH) {
+        length = PREVIEW_LENGTH;
+    }
+
+    for (size_t i = 0; i < length; ++i) {
+        unsigned char c = (unsigned char) chars[i];
+
+        if (c == '\\') {
+            fputs("\\\\", file);
+        } else if (c < 32 || c >= 127) {
+            fprintf(file, "\\x%02x", c);
+        } else {
+            fputc(c, file);
+        }
+    }
+}
+
+/**
+ * Writes an object, if it has not been written yet. Its references are written later.
+ * @param snapshot the snapshot.
+ * @param object the object.
+ */
+static void visit(Snapshot *snapshot, Object *object) {
+    if (!set_add(&snapshot->written, object)) {
+        return;
+    }
+
+    fprintf(snapshot->file, "N %lx %s %zu ", (unsigned long) (uintptr_t) object, object_type_name(object->type),
+            object_size(object));
+    write_preview(snapshot, object);
+    fputc('\n', snapshot->file);
+
+    ObjectArray *pending = &snapshot->pending;
+
+    if (pending->count >= pending->cap) {
+        pending->cap = GROW_CAP(pending->cap);
+        pending->objects = GROW_ARR(pending->objects, Object *, pending->cap);
+    }
+
+    pending->objects[pending->count++] = object;
+}
+
+static void write_edge(Snapshot *snapshot, Object *from, Object *to) {
+    fprintf(snapshot->file, "E %lx %lx\n", (unsigned long) (uintptr_t) from, (unsigned long) (uintptr_t) to);
+    visit(snapshot, to);
+}
+
+static void write_value_edges(Snapshot *snapshot, Object *from, CrispyValue *values, uint64_t count) {
+    for (uint64_t i = 0; i < count; ++i) {
+        if (CHECK_OBJ(values[i])) {
+            write_edge(snapshot, from, AS_OBJ(values[i]));
+        }
+    }
+}
+
+/**
+ * Writes all references of an object (the same ones, that the gc follows).
+ * @param snapshot the snapshot.
+ * @param object the object.
+ */
+static void write_edges(Snapshot *snapshot, Object *object) {
+    switch (object->type) {
+        case OBJ_DICT: {
+            ObjDict *dict = (ObjDict *) object;
+
+            if (dict->shape != NULL) {
+                write_value_edges(snapshot, object, dict->slots, dict->shape->slot_count);
+                return;
+            }
+
+            for (int i = 0; i < dict->content.cap; ++i) {
+                for (HTItem *current = dict->content.buckets[i]; current != NULL; current = current->next) {
+                    write_edge(snapshot, object, (Object *) current->key.key_obj_string);
+                    write_value_edges(snapshot, object, &current->value, 1);
+                }
+            }
+            return;
+        }
+        case OBJ_LIST: {
+            ObjList *list = (ObjList *) object;
+
+            if (list->storage == LIST_GENERIC) {
+                write_value_edges(snapshot, object, list->content.values, list->content.count);
+            } else if (list->storage == LIST_PERSISTENT) {
+                if (list->vector.root != NULL) {
+                    write_edge(snapshot, object, (Object *) list->vector.root);
+                }
+
+                write_value_edges(snapshot, object, list->vector.tail, list->vector.tail_count);
+            }
+            return;
+        }
+        case OBJ_VECTOR_NODE:
+            write_value_edges(snapshot, object, ((ObjVectorNode *) object)->items, VECTOR_WIDTH);
+            return;
+        case OBJ_SLICE:
+            write_edge(snapshot, object, ((ObjSlice *) object)->parent);
+            return;
+        case OBJ_ROPE: {
+            ObjRope *rope = (ObjRope *) object;
+
+            if (rope->left != NULL) {
+                write_edge(snapshot, object, rope->left);
+                write_edge(snapshot, object, rope->right);
+            }
+            return;
+        }
+        case OBJ_LAMBDA: {
+            CallFrame *frame = ((ObjLambda *) object)->call_frame;
+
+            if (frame != NULL) {
+                write_value_edges(snapshot, object, frame->constants.values, frame->constants.count);
+            }
+            return;
+        }
+        default:
+            return;
+    }
+}
+
+static void write_roots(Snapshot *snapshot, CrispyValue *values, uint64_t count) {
+    for (uint64_t i = 0; i < count; ++i) {
+        if (CHECK_OBJ(values[i])) {
+            fprintf(snapshot->file, "R %lx\n", (unsigned long) (uintptr_t) AS_OBJ(values[i]));
+            visit(snapshot, AS_OBJ(values[i]));
+        }
+    }
+}
+
+int64_t write_heap_snapshot(Vm *vm, const char *path) {
+    Snapshot snapshot;
+    snapshot.vm = vm;
+    snapshot.file = fopen(path, "w");
+
+    if (snapshot.file == NULL) {
+        return -1;
+    }
+
+    snapshot.written = (ObjectSet) {0, 0, NULL};
+    snapshot.pending = (ObjectArray) {0, 0, NULL};
+
+    fprintf(snapshot.file, "crispy-heap-snapshot 1\n");
+
+    // the same roots as for the gc, but constants are included, because they are part of the heap as well
+    CallFrame *main_frame = vm->frames[0].function;
+    write_roots(&snapshot, main_frame->variables.values, main_frame->variables.count);
+
+    for (uint32_t i = 0; i < vm->frame_count; ++i) {
+        CallFrame *frame = vm->frames[i].function;
+        write_roots(&snapshot, frame->constants.values, frame->constants.count);
+    }
+
+    write_roots(&snapshot, vm->stack, (uint64_t) (vm->sp - vm->stack));
+
+    while (snapshot.pending.count > 0) {
+        write_edges(&snapshot, snapshot.pending.objects[--snapshot.pending.count]);
+    }
+
+    int64_t written = (int64_t) snapshot.written.count;
+    bool failed = ferror(snapshot.file) != 0;
+
+    failed |= fclose(snapshot.file) != 0;
+    free(snapshot.written.objects);
+    FREE_ARR(snapshot.pending.objects);
+
+    return failed ? -1 : written;
+}
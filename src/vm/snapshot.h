@@ -0,0 +1,32 @@
+// Copyright (c) 2018 Felix Schoeller
+//
+// This source code is licensed under the MIT license found in the
+// LICENSE file in the root directory of this source tree.
+
+#ifndef CRISPY_SNAPSHOT_H
+#define CRISPY_SNAPSHOT_H
+
+#include "vm.h"
+
+/*
+ * A heap snapshot is a text file, which starts with the line "crispy-heap-snapshot 1", followed by one record per line:
+ *
+ *   N <id> <type> <size> <preview>   an object (the size includes the buffers it owns, see object_size)
+ *   E <from> <to>                    a reference from one object to another
+ *   R <id>                           an object, that is referenced by the stack, a variable or a constant
+ *
+ * Ids are hexadecimal and only unique within a single snapshot. The preview contains the first characters of strings
+ * (with backslash escapes), it is empty for every other type.
+ * etc/heap_summary.py computes the retained sizes from a snapshot.
+ */
+
+/**
+ * Writes every object, that is reachable from the roots, and the references between them into a file.
+ * The gc state is not changed, so snapshots can be taken at any time.
+ * @param vm the current vm.
+ * @param path the path of the file.
+ * @return the number of written objects or -1 if the file could not be written.
+ */
+int64_t write_heap_snapshot(Vm *vm, const char *path);
+
+#endif //CRISPY_SNAPSHOT_H
@@ -11,6 +11,7 @@
 #include "memory.h"
 #include "dictionary.h"
 #include "list.h"
+#include "shape.h"
 #include "../util/common.h"
 
 void val_arr_init(ValueArray *value_array) {
@@ -52,30 +53,51 @@ void write_at(ValueArray *value_array, uint64_t index, CrispyValue value) {
     value_array->values[index] = value;
 }
 
+/**
+ * Returns the characters of a string object, if they are already stored in a single buffer.
+ * @param string the string object.
+ * @return a pointer to the characters or NULL if the string is a rope, that has not been flattened yet.
+ */
+static const char *flat_chars(Object *string) {
+    switch (string->type) {
+        case OBJ_ROPE:
+            return ((ObjRope *) string)->flat;
+        case OBJ_SLICE: {
+            // the parent of a slice is always flat (see new_substring)
+            ObjSlice *slice = (ObjSlice *) string;
+            return flat_chars(slice->parent) + slice->offset;
+        }
+        default:
+            return ((ObjString *) string)->chars;
+    }
+}
+
 size_t value_to_string(CrispyValue value, char **dest) {
     char *string = NULL;
     size_t str_len = 0;
 
-    switch (value.type) {
+    switch (VALUE_TYPE(value)) {
         case NUMBER: {
             char s[23];
-            snprintf(s, 23, "%.15g", value.d_value);
+            snprintf(s, 23, "%.15g", AS_NUM(value));
             string = strdup(s);
             str_len = strlen(s);
             break;
         }
         case OBJECT: {
-            Object *object = value.o_value;
+            Object *object = AS_OBJ(value);
 
             switch (object->type) {
-                case OBJ_STRING: {
-                    ObjString *obj_string = ((ObjString *) object);
-                    string = malloc((obj_string->length + 3) * sizeof(char));
-                    memcpy(string + 1, obj_string->start, obj_string->length);
+                case OBJ_STRING:
+                case OBJ_ROPE:
+                case OBJ_SLICE: {
+                    size_t length = string_length(object);
+                    string = malloc((length + 3) * sizeof(char));
+                    copy_string_chars(object, string + 1);
                     string[0] = '"';
-                    string[obj_string->length + 1] = '"';
-                    string[obj_string->length + 2] = '\0';
-                    str_len = ((ObjString *) object)->length + 2;
+                    string[length + 1] = '"';
+                    string[length + 2] = '\0';
+                    str_len = length + 2;
                     break;
                 }
                 case OBJ_LAMBDA:
@@ -99,11 +121,16 @@ size_t value_to_string(CrispyValue value, char **dest) {
                     string = strdup("<list>");
                     str_len = 6;
                     break;
+                case OBJ_VECTOR_NODE:
+                    // the nodes of persistent lists are never visible to the program
+                    string = strdup("<invalid object>");
+                    str_len = 16;
+                    break;
             }
             break;
         }
         case BOOLEAN: {
-            if (value.p_value) {
+            if (AS_BOOL(value)) {
                 string = strdup("true");
                 str_len = 4;
             } else {
@@ -124,10 +151,22 @@ size_t value_to_string(CrispyValue value, char **dest) {
 
 static void print_object(Object *object, const char *new_line, bool print_quotation) {
     switch (object->type) {
-        case OBJ_STRING: {
+        case OBJ_STRING:
+        case OBJ_ROPE:
+        case OBJ_SLICE: {
             const char *quotation = print_quotation ? "\"" : "";
-            ObjString *string = (ObjString *) object;
-            printf("%s%.*s%s%s", quotation, (int) string->length, string->start, quotation, new_line);
+            const char *chars = flat_chars(object);
+            char *copy = NULL;
+
+            // printing doesn't flatten ropes, because the buffer could not be added to the heap size
+            if (chars == NULL) {
+                copy = malloc(string_length(object) * sizeof(char));
+                copy_string_chars(object, copy);
+                chars = copy;
+            }
+
+            printf("%s%.*s%s%s", quotation, (int) string_length(object), chars, quotation, new_line);
+            free(copy);
             break;
         }
         case OBJ_LAMBDA: {
@@ -152,13 +191,13 @@ static void print_object(Object *object, const char *new_line, bool print_quotat
             // TODO Fix print quotation
 
             printf("[");
-            for (int i = 0; i < list->content.count; ++i) {
+            for (uint64_t i = 0; i < list_length(list); ++i) {
                 if (first) {
                     first = false;
                 } else {
                     printf(", ");
                 }
-                print_value(list->content.values[i], false, true);
+                print_value(list_at(list, i), false, true);
             }
             printf("]%s", new_line);
 
@@ -171,15 +210,15 @@ static void print_object(Object *object, const char *new_line, bool print_quotat
 
 void print_value(CrispyValue value, bool new_line, bool print_quotation) {
     const char *nl = (new_line) ? "\n" : "";
-    switch (value.type) {
+    switch (VALUE_TYPE(value)) {
         case NUMBER:
-            printf("%.15g%s", value.d_value, nl);
+            printf("%.15g%s", AS_NUM(value), nl);
             break;
         case BOOLEAN:
             printf("%s%s", BOOL_STRING(value), nl);
             break;
         case OBJECT:
-            print_object(value.o_value, nl, print_quotation);
+            print_object(AS_OBJ(value), nl, print_quotation);
             break;
         case NIL:
             printf("nil%s", nl);
@@ -190,39 +229,13 @@ void print_value(CrispyValue value, bool new_line, bool print_quotation) {
     }
 }
 
-CrispyValue create_nil() {
-    CrispyValue val;
-    val.type = NIL;
-    val.p_value = 0;
-    return val;
-}
-
-CrispyValue create_number(double value) {
-    CrispyValue val;
-    val.type = NUMBER;
-    val.d_value = value;
-    return val;
-}
-
-CrispyValue create_bool(bool value) {
-    CrispyValue val;
-    val.type = BOOLEAN;
-    val.p_value = (value) ? 1 : 0;
-    return val;
-}
-
-CrispyValue create_object(Object *object) {
-    CrispyValue val;
-    val.type = OBJECT;
-    val.o_value = object;
-    return val;
-}
-
 void print_object_type(CrispyValue value) {
-    Object *object = value.o_value;
+    Object *object = AS_OBJ(value);
 
     switch (object->type) {
         case OBJ_STRING:
+        case OBJ_ROPE:
+        case OBJ_SLICE:
             printf(" : STRING\n");
             break;
         case OBJ_LAMBDA:
@@ -238,7 +251,7 @@ void print_object_type(CrispyValue value) {
 }
 
 void print_type(CrispyValue value) {
-    switch (value.type) {
+    switch (VALUE_TYPE(value)) {
         case NUMBER:
             printf(" : NUMBER\n");
             break;
@@ -254,6 +267,29 @@ void print_type(CrispyValue value) {
     }
 }
 
+const char *object_type_name(ObjectType type) {
+    switch (type) {
+        case OBJ_STRING:
+            return "string";
+        case OBJ_LAMBDA:
+            return "lambda";
+        case OBJ_NATIVE_FUNC:
+            return "native_func";
+        case OBJ_DICT:
+            return "dict";
+        case OBJ_LIST:
+            return "list";
+        case OBJ_ROPE:
+            return "rope";
+        case OBJ_SLICE:
+            return "slice";
+        case OBJ_VECTOR_NODE:
+            return "vector_node";
+    }
+
+    return "unknown";
+}
+
 void code_buff_init(CodeBuffer *code_buffer) {
     code_buffer->cap = 0;
     code_buffer->count = 0;
@@ -265,26 +301,6 @@ void code_buff_free(CodeBuffer *code_buffer) {
     code_buff_init(code_buffer);
 }
 
-CallFrame *new_temp_call_frame(CallFrame *other) {
-    CallFrame *call_frame = malloc(sizeof(CallFrame));
-    call_frame->code_buffer = other->code_buffer;
-    call_frame->ip = other->ip;
-
-    ValueArray variables;
-    val_arr_init(&variables);
-    call_frame->variables = variables;
-
-    call_frame->constants = other->constants;
-
-    return call_frame;
-}
-
-void temp_call_frame_free(CallFrame *call_frame) {
-    val_arr_free(&call_frame->variables);
-    val_arr_init(&call_frame->variables);
-    free(call_frame);
-}
-
 CallFrame *new_call_frame() {
     CallFrame *call_frame = malloc(sizeof(CallFrame));
     call_frame->ip = NULL;
@@ -301,6 +317,11 @@ CallFrame *new_call_frame() {
     val_arr_init(&constants);
     call_frame->constants = constants;
 
+    CacheArray caches;
+    cache_arr_init(&caches);
+    call_frame->caches = caches;
+    call_frame->local_count = 0;
+
     return call_frame;
 }
 
@@ -313,14 +334,24 @@ void call_frame_free(CallFrame *call_frame) {
     val_arr_init(&call_frame->variables);
     val_arr_init(&call_frame->constants);
 
+    cache_arr_free(&call_frame->caches);
+
     free(call_frame);
 }
 
+size_t call_frame_size(CallFrame *call_frame) {
+    return sizeof(CallFrame)
+           + call_frame->code_buffer.cap * sizeof(uint8_t)
+           + call_frame->variables.cap * sizeof(CrispyValue)
+           + call_frame->constants.cap * sizeof(CrispyValue)
+           + call_frame->caches.cap * sizeof(InlineCache);
+}
+
 #define ALLOC_OBJ(vm, type, object_type) ((type *)allocate_object((vm), sizeof(type), (object_type)))
 
 /**
  * Allocates a new Object on the heap.
- * Also adds it to the linked list of objects inside the VM and performs garbage collection,
+ * Also adds it to the young generation and performs garbage collection,
  * if the threshold of allocated objects is surpassed.
  * @param vm the current VM.
  * @param size the size, that needs to be allocated in bytes.
@@ -328,17 +359,41 @@ void call_frame_free(CallFrame *call_frame) {
  * @return a pointer to the created object.
  */
 static Object *allocate_object(Vm *vm, size_t size, ObjectType type) {
-    if (vm->current_status == VM_STATUS_RUNNING && vm->allocated_mem >= vm->max_alloc_mem) {
-        gc(vm);
+    if (vm->current_status == VM_STATUS_RUNNING) {
+        if (vm->gc_phase == GC_PHASE_SWEEPING) {
+            // the next full collection has to wait until the sweep is done, minor collections don't
+            sweep_step(vm);
+        }
+
+        if (vm->gc_phase == GC_PHASE_CLEARING || vm->gc_phase == GC_PHASE_MARKING) {
+            // minor collections have to wait until the current cycle is finished
+            gc_step(vm);
+        } else if (vm->gc_phase == GC_PHASE_IDLE && vm->allocated_mem >= vm->max_alloc_mem) {
+            if (vm->incremental_gc) {
+                gc_step(vm);
+            } else {
+                gc(vm);
+            }
+        } else if (vm->young_mem >= NURSERY_SIZE) {
+            minor_gc(vm);
+        }
     }
 
-    Object *object = malloc(size);
+    if (vm->allocated_mem + size > vm->heap_limit) {
+        check_heap_limit(vm, size);
+    }
+
+    Object *object = slab_alloc(&vm->slabs, size);
     object->type = type;
-    object->marked = true;
+    object->marked = false;
+    object->remembered = false;
+    object->permanent = false;
 
-    object->next = vm->first_object;
-    vm->first_object = object;
+    object->next = vm->young_objects;
+    vm->young_objects = object;
     vm->allocated_mem += size;
+    vm->young_mem += size;
+    vm->cycle_allocated += size;
 
 #if DEBUG_TRACE_GC
     printf("[%p] Allocated %ld bytes for object of type %d\n", object, size, type);
@@ -347,43 +402,220 @@ static Object *allocate_object(Vm *vm, size_t size, ObjectType type) {
     return object;
 }
 
+static ObjString *copy_string(Vm *vm, const char *start, size_t length) {
+    ObjString *string = new_empty_string(vm, length);
+    memcpy(string->chars, start, length);
+
+    return string;
+}
+
 ObjString *new_string(Vm *vm, const char *start, size_t length) {
-    ObjString *string = ALLOC_OBJ(vm, ObjString, OBJ_STRING);
+#if INTERN_ON_CREATION
+    return new_interned_string(vm, start, length);
+#else
+    return copy_string(vm, start, length);
+#endif
+}
+
+ObjString *new_empty_string(Vm *vm, size_t length) {
+    // header and characters share a single allocation
+    ObjString *string = (ObjString *) allocate_object(vm, sizeof(ObjString) + length * sizeof(char), OBJ_STRING);
     string->length = length;
     string->hashed = false;
+    string->interned = false;
 
-    size_t size = length * sizeof(char);
-    char *value = malloc(size);
-    memcpy(value, start, length);
+    return string;
+}
 
-    vm->allocated_mem += size;
+static void add_interned(Vm *vm, ObjString *string) {
+    HTItemKey key;
+    key.key_ident_string = string->chars;
+    key.ident_length = string->length;
 
-#if DEBUG_TRACE_GC
-    printf("[%p] Allocated %ld bytes for string\n", string, size);
-#endif
+    string->interned = true;
+    ht_put(&vm->strings, key, create_object((Object *) string));
+
+    // the item of the intern table is freed together with the string
+    track_memory(vm, 0, sizeof(HTItem));
+}
+
+ObjString *new_interned_string(Vm *vm, const char *start, size_t length) {
+    HTItemKey key;
+    key.key_ident_string = start;
+    key.ident_length = length;
+
+    CrispyValue item = ht_get(&vm->strings, key);
 
-    string->start = value;
+    if (!CHECK_NIL(item)) {
+        return (ObjString *) AS_OBJ(item);
+    }
+
+    ObjString *string = copy_string(vm, start, length);
+    add_interned(vm, string);
     return string;
 }
 
-ObjString *new_empty_string(Vm *vm, size_t length) {
-    ObjString *string = ALLOC_OBJ(vm, ObjString, OBJ_STRING);
-    string->length = length;
-    string->hashed = false;
+ObjString *find_interned(Vm *vm, const char *start, size_t length) {
+    HTItemKey key;
+    key.key_ident_string = start;
+    key.ident_length = length;
 
-    size_t size = length * sizeof(char);
-    char *value = malloc(size);
-    string->start = value;
+    CrispyValue item = ht_get(&vm->strings, key);
 
-    vm->allocated_mem += size;
+    return CHECK_NIL(item) ? NULL : (ObjString *) AS_OBJ(item);
+}
 
-#if DEBUG_TRACE_GC
-    printf("[%p] Allocated %ld bytes for string\n", string, size);
-#endif
+ObjString *intern_string(Vm *vm, ObjString *string) {
+    if (string->interned) {
+        return string;
+    }
+
+    ObjString *interned = find_interned(vm, string->chars, string->length);
+
+    if (interned != NULL) {
+        return interned;
+    }
 
+    add_interned(vm, string);
     return string;
 }
 
+ObjString *intern_string_obj(Vm *vm, Object *string) {
+    if (string->type == OBJ_STRING) {
+        return intern_string(vm, (ObjString *) string);
+    }
+
+    const char *chars = string_chars(vm, string);
+    size_t length = string_length(string);
+    ObjString *interned = find_interned(vm, chars, length);
+
+    if (interned != NULL) {
+        return interned;
+    }
+
+    // the callers might hold unrooted values, so this must not trigger a gc
+    VmStatus status = vm->current_status;
+    vm->current_status = VM_STATUS_NO_GC;
+    interned = copy_string(vm, chars, length);
+    vm->current_status = status;
+
+    add_interned(vm, interned);
+    return interned;
+}
+
+ObjRope *new_rope(Vm *vm, Object *left, Object *right) {
+    ObjRope *rope = ALLOC_OBJ(vm, ObjRope, OBJ_ROPE);
+    rope->length = string_length(left) + string_length(right);
+
+    rope->left = left;
+    rope->right = right;
+    rope->flat = NULL;
+
+    return rope;
+}
+
+Object *new_substring(Vm *vm, Object *string, size_t start, size_t length) {
+    if (length == 1) {
+        return (Object *) vm->single_chars[(uint8_t) string_chars(vm, string)[start]];
+    }
+
+    if (length < MIN_SLICE_LENGTH) {
+        return (Object *) new_string(vm, string_chars(vm, string) + start, length);
+    }
+
+    // slices always reference the flat string, so that they never form chains
+    if (string->type == OBJ_SLICE) {
+        start += ((ObjSlice *) string)->offset;
+        string = ((ObjSlice *) string)->parent;
+    }
+
+    // flatten ropes before they are referenced
+    string_chars(vm, string);
+
+    ObjSlice *slice = ALLOC_OBJ(vm, ObjSlice, OBJ_SLICE);
+    slice->length = length;
+    slice->parent = string;
+    slice->offset = start;
+
+    return (Object *) slice;
+}
+
+size_t string_length(Object *string) {
+    switch (string->type) {
+        case OBJ_ROPE:
+            return ((ObjRope *) string)->length;
+        case OBJ_SLICE:
+            return ((ObjSlice *) string)->length;
+        default:
+            return ((ObjString *) string)->length;
+    }
+}
+
+void copy_string_chars(Object *string, char *dest) {
+    const char *chars = flat_chars(string);
+
+    if (chars != NULL) {
+        memcpy(dest, chars, string_length(string));
+        return;
+    }
+
+    // ropes created in loops are extremely deep, so the tree is traversed with an explicit stack
+    size_t offset = 0;
+
+    uint64_t cap = 8;
+    uint64_t count = 0;
+    Object **stack = malloc(cap * sizeof(Object *));
+    stack[count++] = string;
+
+    while (count > 0) {
+        Object *current = stack[--count];
+
+        if (current->type == OBJ_ROPE && ((ObjRope *) current)->flat == NULL) {
+            if (count + 2 > cap) {
+                cap = GROW_CAP(cap);
+                stack = GROW_ARR(stack, Object *, cap);
+            }
+
+            // the left child has to be copied first
+            stack[count++] = ((ObjRope *) current)->right;
+            stack[count++] = ((ObjRope *) current)->left;
+            continue;
+        }
+
+        size_t length = string_length(current);
+        memcpy(dest + offset, flat_chars(current), length);
+        offset += length;
+    }
+
+    FREE_ARR(stack);
+}
+
+/**
+ * Copies all leaves of a rope into a single buffer and releases its children.
+ * The buffer is part of the heap size, so that the gc and the heap limit take it into account.
+ * @param vm the current vm.
+ * @param rope the rope.
+ */
+static void flatten(Vm *vm, ObjRope *rope) {
+    char *buffer = malloc(rope->length * sizeof(char));
+    copy_string_chars((Object *) rope, buffer);
+
+    rope->flat = buffer;
+    rope->left = NULL;
+    rope->right = NULL;
+
+    // see object_size
+    track_memory(vm, 0, rope->length * sizeof(char));
+}
+
+const char *string_chars(Vm *vm, Object *string) {
+    if (string->type == OBJ_ROPE && ((ObjRope *) string)->flat == NULL) {
+        flatten(vm, (ObjRope *) string);
+    }
+
+    return flat_chars(string);
+}
+
 ObjLambda *new_lambda(Vm *vm, uint8_t num_params) {
     ObjLambda *lambda = ALLOC_OBJ(vm, ObjLambda, OBJ_LAMBDA);
     lambda->num_params = num_params;
@@ -402,23 +634,24 @@ ObjNativeFunc *new_native_func(Vm *vm, void *func_ptr, uint8_t num_args, bool sy
     return n_fn;
 }
 
-ObjDict *new_dict(Vm *vm, HashTable content) {
+ObjDict *new_dict(Vm *vm) {
     ObjDict *dict = ALLOC_OBJ(vm, ObjDict, OBJ_DICT);
-    dict->content = content;
+    dict->shape = vm->root_shape;
+    dict->slots = NULL;
+    dict->slot_cap = 0;
 
     return dict;
 }
 
 ObjList *new_list(Vm *vm, size_t size) {
     ObjList *list = ALLOC_OBJ(vm, ObjList, OBJ_LIST);
-    ValueArray val_arr;
-    val_arr_init(&val_arr);
 
-    val_arr.count = (uint32_t) size;
-    val_arr.cap = next_pow_of_2(val_arr.count);
-    val_arr.values = GROW_ARR(val_arr.values, CrispyValue, val_arr.cap);
-
-    list->content = val_arr;
+    // an empty list only contains numbers
+    list->storage = LIST_PACKED;
+    list->numbers.count = 0;
+    list->numbers.cap = size;
+    list->numbers.values = size > 0 ? malloc(size * sizeof(double)) : NULL;
+    track_memory(vm, 0, list_memory(list));
 
     return list;
 }
@@ -440,7 +673,7 @@ uint32_t hash_string_obj(ObjString *string) {
         return string->hash;
     }
 
-    uint32_t hash = hash_string(string->start, string->length);
+    uint32_t hash = hash_string(string->chars, string->length);
 
     string->hash = hash;
     string->hashed = true;
@@ -455,48 +688,100 @@ uint32_t hash_uint32_t(uint32_t x) {
     return x;
 }
 
-int cmp_strings(ObjString *first, ObjString *second) {
+int cmp_strings(Vm *vm, Object *first, Object *second) {
     if (first == second) {
         return 0;
     }
 
-    size_t smaller_length = (first->length < second->length) ? first->length : second->length;
-    return memcmp(first->start, second->start, smaller_length);
+    size_t first_length = string_length(first);
+    size_t second_length = string_length(second);
+
+    size_t smaller_length = (first_length < second_length) ? first_length : second_length;
+    int result = memcmp(string_chars(vm, first), string_chars(vm, second), smaller_length);
+
+    if (result != 0 || first_length == second_length) {
+        return result;
+    }
+
+    return first_length < second_length ? -1 : 1;
+}
+
+bool strings_equal(ObjString *first, ObjString *second) {
+    if (first == second) {
+        return true;
+    }
+
+    // there is only one interned string per content
+    if ((first->interned && second->interned) || first->length != second->length) {
+        return false;
+    }
+
+    return memcmp(first->chars, second->chars, first->length) == 0;
+}
+
+bool values_equal(Vm *vm, CrispyValue first, CrispyValue second) {
+    if (CHECK_OBJ(first) && CHECK_OBJ(second)) {
+        Object *first_obj = AS_OBJ(first);
+        Object *second_obj = AS_OBJ(second);
+
+        if (first_obj == second_obj) {
+            return true;
+        }
+
+        if (first_obj->type == OBJ_STRING && second_obj->type == OBJ_STRING) {
+            return strings_equal((ObjString *) first_obj, (ObjString *) second_obj);
+        }
+
+        if (IS_STRING_OBJ(first_obj) && IS_STRING_OBJ(second_obj)) {
+            // avoid flattening ropes of different lengths
+            return string_length(first_obj) == string_length(second_obj) && cmp_strings(vm, first_obj, second_obj) == 0;
+        }
+    }
+
+    return cmp_values(vm, first, second) == 0;
 }
 
-int cmp_values(CrispyValue first, CrispyValue second) {
-    if (first.type != second.type) {
+int cmp_values(Vm *vm, CrispyValue first, CrispyValue second) {
+    ValueType type = VALUE_TYPE(first);
+
+    if (type != VALUE_TYPE(second)) {
         return 1;
     }
 
-    switch (first.type) {
+    switch (type) {
         case NUMBER:
-            if (first.d_value == second.d_value) {
+            if (CHECK_INT(first) && CHECK_INT(second)) {
+                return (AS_INT(first) > AS_INT(second)) - (AS_INT(first) < AS_INT(second));
+            }
+
+            if (AS_NUM(first) == AS_NUM(second)) {
                 return 0;
             }
-            return first.d_value < second.d_value ? -1 : 1;
+            return AS_NUM(first) < AS_NUM(second) ? -1 : 1;
         case OBJECT:
-            return cmp_objects(first.o_value, second.o_value);
+            return cmp_objects(vm, AS_OBJ(first), AS_OBJ(second));
         case BOOLEAN:
-            if (first.p_value == second.p_value) {
+            if (AS_BOOL(first) == AS_BOOL(second)) {
                 return 0;
             }
-            return first.p_value < second.p_value ? -1 : 1;
+            return AS_BOOL(first) < AS_BOOL(second) ? -1 : 1;
         case NIL:
-            return second.type != NIL;
+            return 0;
     }
 
     return 1;
 }
 
-int cmp_objects(Object *first, Object *second) {
+int cmp_objects(Vm *vm, Object *first, Object *second) {
+    if (IS_STRING_OBJ(first) && IS_STRING_OBJ(second)) {
+        return cmp_strings(vm, first, second);
+    }
+
     if (first->type != second->type) {
         return 1;
     }
 
     switch (first->type) {
-        case OBJ_STRING:
-            return cmp_strings((ObjString *) first, (ObjString *) second);
         case OBJ_DICT:
             // TODO implement
             break;
@@ -510,9 +795,135 @@ int cmp_objects(Object *first, Object *second) {
     return 1;
 }
 
-ObjList *clone_list(Vm *vm, ObjList *list) {
-    ObjList *clone = new_list(vm, list->content.count);
-    memcpy(clone->content.values, list->content.values, list->content.count * sizeof(CrispyValue));
+static ObjVectorNode *new_vector_node(Vm *vm, ObjVectorNode *other) {
+    ObjVectorNode *node = ALLOC_OBJ(vm, ObjVectorNode, OBJ_VECTOR_NODE);
+
+    if (other != NULL) {
+        memcpy(node->items, other->items, sizeof(node->items));
+        return node;
+    }
+
+    for (uint32_t i = 0; i < VECTOR_WIDTH; ++i) {
+        node->items[i] = create_nil();
+    }
+
+    return node;
+}
+
+/**
+ * Creates a chain of inner nodes down to a leaf.
+ * @param vm the current vm.
+ * @param level the level of the topmost node.
+ * @param leaf the leaf at the end of the chain.
+ * @return the topmost node.
+ */
+static ObjVectorNode *new_path(Vm *vm, uint32_t level, ObjVectorNode *leaf) {
+    if (level == 0) {
+        return leaf;
+    }
+
+    ObjVectorNode *node = new_vector_node(vm, NULL);
+    node->items[0] = create_object((Object *) new_path(vm, level - VECTOR_BITS, leaf));
+    return node;
+}
+
+/**
+ * Inserts a leaf into the subtree of parent. Every node on the way is copied, unless in_place is set.
+ * @param vm the current vm.
+ * @param level the level of parent (greater than 0).
+ * @param parent the root of the subtree.
+ * @param leaf the new leaf.
+ * @param index the index of the first element inside the leaf.
+ * @param in_place true if the nodes are not shared with any other list.
+ * @return the new root of the subtree.
+ */
+static ObjVectorNode *push_leaf(Vm *vm, uint32_t level, ObjVectorNode *parent, ObjVectorNode *leaf, uint64_t index,
+                                bool in_place) {
+    ObjVectorNode *node = in_place ? parent : new_vector_node(vm, parent);
+    uint32_t sub_index = (uint32_t) ((index >> level) & VECTOR_MASK);
+    CrispyValue child = parent->items[sub_index];
+
+    if (level == VECTOR_BITS) {
+        node->items[sub_index] = create_object((Object *) leaf);
+    } else if (CHECK_NIL(child)) {
+        node->items[sub_index] = create_object((Object *) new_path(vm, level - VECTOR_BITS, leaf));
+    } else {
+        ObjVectorNode *child_node = (ObjVectorNode *) AS_OBJ(child);
+        node->items[sub_index] = create_object(
+                (Object *) push_leaf(vm, level - VECTOR_BITS, child_node, leaf, index, in_place));
+    }
+
+    return node;
+}
+
+static void vector_append(Vm *vm, Vector *vector, CrispyValue value, bool in_place) {
+    if (vector->tail_count == VECTOR_WIDTH) {
+        uint64_t trie_count = vector->count - vector->tail_count;
+
+        ObjVectorNode *leaf = new_vector_node(vm, NULL);
+        memcpy(leaf->items, vector->tail, sizeof(leaf->items));
+
+        if (vector->root == NULL) {
+            vector->root = leaf;
+            vector->shift = 0;
+        } else if (trie_count >= (uint64_t) 1 << (vector->shift + VECTOR_BITS)) {
+            // the trie is full, so it grows by one level
+            ObjVectorNode *root = new_vector_node(vm, NULL);
+            root->items[0] = create_object((Object *) vector->root);
+            root->items[1] = create_object((Object *) new_path(vm, vector->shift, leaf));
+
+            vector->root = root;
+            vector->shift += VECTOR_BITS;
+        } else {
+            vector->root = push_leaf(vm, vector->shift, vector->root, leaf, trie_count, in_place);
+        }
+
+        vector->tail_count = 0;
+    }
+
+    vector->tail[vector->tail_count++] = value;
+    vector->count++;
+}
+
+ObjList *new_appended_list(Vm *vm, ObjList *list, CrispyValue value) {
+    ObjList *result = ALLOC_OBJ(vm, ObjList, OBJ_LIST);
+
+    // the new nodes are only reachable from the C stack until the list is complete
+    VmStatus status = vm->current_status;
+    vm->current_status = VM_STATUS_NO_GC;
+
+    Vector *vector = &result->vector;
+    bool shared = list->storage == LIST_PERSISTENT;
+
+    if (shared) {
+        *vector = list->vector;
+    } else {
+        vector->count = 0;
+        vector->shift = 0;
+        vector->root = NULL;
+        vector->tail_count = 0;
+    }
+
+    CrispyValue *tail = malloc(VECTOR_WIDTH * sizeof(CrispyValue));
+
+    // an empty tail might not have been allocated yet
+    if (vector->tail_count > 0) {
+        memcpy(tail, vector->tail, vector->tail_count * sizeof(CrispyValue));
+    }
+    vector->tail = tail;
+
+    if (!shared) {
+        for (uint64_t i = 0; i < list_length(list); ++i) {
+            vector_append(vm, vector, list_at(list, i), true);
+        }
+    }
+
+    // the nodes of the original list must not be changed
+    vector_append(vm, vector, value, !shared);
+
+    result->storage = LIST_PERSISTENT;
+    track_memory(vm, 0, list_memory(result));
+    vm->current_status = status;
 
-    return clone;
+    return result;
 }
@@ -6,15 +6,31 @@
 #ifndef VALUE_H
 #define VALUE_H
 
+#include <string.h>
+#include <math.h>
+
 #include "../util/common.h"
+#include "options.h"
+#include "slab.h"
 
-#define CHECK_TYPE(val, check_type) ((val).type == (check_type))
+#define CHECK_TYPE(val, check_type) (CHECK_##check_type(val))
 
 #define CHECK_NUM(num) (CHECK_TYPE((num), NUMBER))
+#define CHECK_INT(num) (CHECK_TYPE((num), INTEGER))
 #define CHECK_BOOL(bool_val) (CHECK_TYPE((bool_val), BOOLEAN))
+#define CHECK_OBJ(obj_val) (CHECK_TYPE((obj_val), OBJECT))
+#define CHECK_OBJ_TYPE(val, obj_type) (CHECK_OBJ(val) && AS_OBJ(val)->type == (obj_type))
+
+// ropes and slices behave exactly like strings
+#define IS_STRING_OBJ(obj) ((obj)->type == OBJ_STRING || (obj)->type == OBJ_ROPE || (obj)->type == OBJ_SLICE)
+#define CHECK_STRING(val) (CHECK_OBJ(val) && IS_STRING_OBJ(AS_OBJ(val)))
 
-#define BOOL_TRUE(bool_val) ((bool_val).p_value == 1)
-#define BOOL_STRING(bool_val) (((bool_val).p_value == 1) ? "true" : "false")
+#define BOOL_TRUE(bool_val) (AS_BOOL(bool_val))
+#define BOOL_STRING(bool_val) ((AS_BOOL(bool_val)) ? "true" : "false")
+
+// integral numbers in this range are stored as small integers, everything else as a double
+#define SMALL_INT_MAX (((int64_t) 1 << 47) - 1)
+#define SMALL_INT_MIN (-((int64_t) 1 << 47))
 
 typedef struct object_t Object;
 
@@ -22,15 +38,203 @@ typedef enum {
     NIL, NUMBER, OBJECT, BOOLEAN
 } ValueType;
 
+#if NAN_BOXING
+
+/*
+ * Every value is packed into a single 64 bit word.
+ * Doubles are stored as they are. All other values are hidden inside the unused bits of a quiet NaN:
+ * objects set the sign bit and store their (48 bit) pointer in the lower bits,
+ * small integers set the INT_TAG bit and store their (48 bit) two's complement in the lower bits,
+ * nil, false and true are represented by the tags 1, 2 and 3.
+ */
+typedef uint64_t CrispyValue;
+
+#define SIGN_BIT    ((uint64_t) 0x8000000000000000)
+#define QNAN        ((uint64_t) 0x7ffc000000000000)
+#define INT_TAG     ((uint64_t) 0x0002000000000000)
+#define INT_MASK    ((uint64_t) 0x0000ffffffffffff)
+
+#define TAG_NIL     1
+#define TAG_FALSE   2
+#define TAG_TRUE    3
+
+#define NIL_VAL     ((CrispyValue) (QNAN | TAG_NIL))
+#define FALSE_VAL   ((CrispyValue) (QNAN | TAG_FALSE))
+#define TRUE_VAL    ((CrispyValue) (QNAN | TAG_TRUE))
+
+#define CHECK_NIL(val)      ((val) == NIL_VAL)
+#define CHECK_DOUBLE(val)   (((val) & QNAN) != QNAN)
+#define CHECK_INTEGER(val)  (((val) & (SIGN_BIT | QNAN | INT_TAG)) == (QNAN | INT_TAG))
+#define CHECK_NUMBER(val)   (CHECK_DOUBLE(val) || CHECK_INTEGER(val))
+#define CHECK_BOOLEAN(val)  (((val) | 1) == TRUE_VAL)
+#define CHECK_OBJECT(val)   (((val) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+
+#define AS_NUM(val)     (value_to_num(val))
+// shifting the payload to the top and back sign extends it
+#define AS_INT(val)     (((int64_t) ((val) << 16)) >> 16)
+#define AS_BOOL(val)    ((val) == TRUE_VAL)
+#define AS_OBJ(val)     ((Object *) (uintptr_t) ((val) & ~(SIGN_BIT | QNAN)))
+
+static inline double value_to_num(CrispyValue value) {
+    if (CHECK_INTEGER(value)) {
+        return (double) AS_INT(value);
+    }
+
+    double num;
+    memcpy(&num, &value, sizeof(double));
+    return num;
+}
+
+static inline CrispyValue create_nil() {
+    return NIL_VAL;
+}
+
+static inline CrispyValue create_bool(bool value) {
+    return value ? TRUE_VAL : FALSE_VAL;
+}
+
+static inline CrispyValue create_number(double value) {
+    CrispyValue val;
+    memcpy(&val, &value, sizeof(double));
+    return val;
+}
+
+static inline CrispyValue create_int(int64_t value) {
+    if (value < SMALL_INT_MIN || value > SMALL_INT_MAX) {
+        return create_number((double) value);
+    }
+
+    return (CrispyValue) (QNAN | INT_TAG | ((uint64_t) value & INT_MASK));
+}
+
+static inline CrispyValue create_object(Object *object) {
+    return (CrispyValue) (SIGN_BIT | QNAN | (uint64_t) (uintptr_t) object);
+}
+
+static inline ValueType value_type(CrispyValue value) {
+    if (CHECK_NUMBER(value)) {
+        return NUMBER;
+    }
+
+    if (CHECK_OBJECT(value)) {
+        return OBJECT;
+    }
+
+    return CHECK_NIL(value) ? NIL : BOOLEAN;
+}
+
+#else
+
 typedef struct {
     ValueType type;
+    // numbers can either be stored as double or as small integer
+    bool is_int;
     union {
         double d_value;     // number
+        int64_t i_value;    // small integer
         uint64_t p_value;   // primitive value (e.g. boolean)
         Object *o_value;    // object pointer
     };
 } CrispyValue;
 
+#define CHECK_NIL(val)      ((val).type == NIL)
+#define CHECK_NUMBER(val)   ((val).type == NUMBER)
+#define CHECK_INTEGER(val)  ((val).type == NUMBER && (val).is_int)
+#define CHECK_BOOLEAN(val)  ((val).type == BOOLEAN)
+#define CHECK_OBJECT(val)   ((val).type == OBJECT)
+
+#define AS_NUM(val)     ((val).is_int ? (double) (val).i_value : (val).d_value)
+#define AS_INT(val)     ((val).i_value)
+#define AS_BOOL(val)    ((val).p_value == 1)
+#define AS_OBJ(val)     ((val).o_value)
+
+static inline CrispyValue create_nil() {
+    CrispyValue val;
+    val.type = NIL;
+    val.is_int = false;
+    val.p_value = 0;
+    return val;
+}
+
+static inline CrispyValue create_bool(bool value) {
+    CrispyValue val;
+    val.type = BOOLEAN;
+    val.is_int = false;
+    val.p_value = (value) ? 1 : 0;
+    return val;
+}
+
+static inline CrispyValue create_number(double value) {
+    CrispyValue val;
+    val.type = NUMBER;
+    val.is_int = false;
+    val.d_value = value;
+    return val;
+}
+
+static inline CrispyValue create_int(int64_t value) {
+    if (value < SMALL_INT_MIN || value > SMALL_INT_MAX) {
+        return create_number((double) value);
+    }
+
+    CrispyValue val;
+    val.type = NUMBER;
+    val.is_int = true;
+    val.i_value = value;
+    return val;
+}
+
+static inline CrispyValue create_object(Object *object) {
+    CrispyValue val;
+    val.type = OBJECT;
+    val.is_int = false;
+    val.o_value = object;
+    return val;
+}
+
+static inline ValueType value_type(CrispyValue value) {
+    return value.type;
+}
+
+#endif
+
+#define VALUE_TYPE(val) (value_type(val))
+
+/**
+ * Creates a number, which is stored as small integer if the value is integral and small enough.
+ * @param value the value.
+ * @return the created number.
+ */
+static inline CrispyValue create_integral(double value) {
+    // -0 has to stay a double, because it is printed differently
+    if (value >= SMALL_INT_MIN && value <= SMALL_INT_MAX && value == (double) (int64_t) value
+        && !(value == 0 && signbit(value))) {
+        return create_int((int64_t) value);
+    }
+
+    return create_number(value);
+}
+
+/**
+ * Converts a number into a list index.
+ * @param value the value.
+ * @param index the pointer, which will hold the index.
+ * @return false if the value is not an integral number.
+ */
+static inline bool to_index(CrispyValue value, int64_t *index) {
+    if (CHECK_INT(value)) {
+        *index = AS_INT(value);
+        return true;
+    }
+
+    if (!CHECK_NUM(value) || floor(AS_NUM(value)) != AS_NUM(value)) {
+        return false;
+    }
+
+    *index = (int64_t) AS_NUM(value);
+    return true;
+}
+
 typedef struct {
     uint64_t cap;
     uint64_t count;
@@ -43,6 +247,15 @@ typedef struct {
     uint8_t *code;
 } CodeBuffer;
 
+// see shape.h
+typedef struct inline_cache_t InlineCache;
+
+typedef struct {
+    uint64_t cap;
+    uint64_t count;
+    InlineCache *caches;
+} CacheArray;
+
 typedef struct s_call_frame {
     uint8_t *ip;
 
@@ -50,6 +263,12 @@ typedef struct s_call_frame {
 
     ValueArray variables;
     ValueArray constants;
+
+    // the inline caches of all field accesses inside the code buffer
+    CacheArray caches;
+
+    // the number of variable slots, that a call of this function needs on the value stack (only used by lambdas)
+    uint32_t local_count;
 } CallFrame;
 
 typedef enum {
@@ -57,26 +276,83 @@ typedef enum {
     OBJ_LAMBDA,
     OBJ_NATIVE_FUNC,
     OBJ_DICT,
-    OBJ_LIST
+    OBJ_LIST,
+    OBJ_ROPE,
+    OBJ_SLICE,
+    // internal node of a persistent list (never visible to scripts)
+    OBJ_VECTOR_NODE
 } ObjectType;
 
+#define OBJECT_TYPE_COUNT (OBJ_VECTOR_NODE + 1)
+
 struct object_t {
+    // old objects stay marked between collections (sticky mark bits)
     uint8_t marked;
+    // true if the object is part of the remembered set
+    uint8_t remembered;
+    // permanent objects are never collected (see make_permanent)
+    uint8_t permanent;
     ObjectType type;
 
     struct object_t *next;
 };
 
+/**
+ * Makes an object live as long as the vm. It stays marked, so the gc neither traces nor frees it.
+ * Only objects, which are never changed and only reference other permanent objects, may be made permanent
+ * (e.g. compile time constants).
+ * @param object the object.
+ */
+static inline void make_permanent(Object *object) {
+    object->permanent = 1;
+    object->marked = 1;
+}
+
 typedef struct {
     Object object;
 
     size_t length;
-    const char *start;
 
     bool hashed;
     uint32_t hash;
+
+    // interned strings are unique, so they can be compared by identity
+    bool interned;
+
+    // the characters are allocated together with the header (not null terminated)
+    char chars[];
 } ObjString;
 
+/*
+ * The lazy result of a string concatenation.
+ * The characters are only copied into a single buffer, once they are actually needed.
+ */
+typedef struct {
+    Object object;
+
+    size_t length;
+
+    // strings or other ropes. Both are released once the rope has been flattened
+    Object *left;
+    Object *right;
+
+    // NULL until the rope is flattened
+    char *flat;
+} ObjRope;
+
+/*
+ * A part of another string, which references the characters of its parent instead of copying them.
+ */
+typedef struct {
+    Object object;
+
+    size_t length;
+
+    // a string or a flattened rope, which is kept alive by the slice
+    Object *parent;
+    size_t offset;
+} ObjSlice;
+
 typedef struct {
     Object object;
 
@@ -94,22 +370,17 @@ typedef struct {
     void *func_ptr;
 } ObjNativeFunc;
 
-CrispyValue create_nil();
-
-CrispyValue create_bool(bool value);
-
-CrispyValue create_number(double value);
-
-CrispyValue create_object(Object *object);
-
 CallFrame *new_call_frame();
 
-CallFrame *new_temp_call_frame(CallFrame *other);
-
-void temp_call_frame_free(CallFrame *call_frame);
-
 void call_frame_free(CallFrame *call_frame);
 
+/**
+ * Computes the size of a call frame including its code, constants, variables and inline caches.
+ * @param call_frame the call frame.
+ * @return the size in bytes.
+ */
+size_t call_frame_size(CallFrame *call_frame);
+
 void val_arr_init(ValueArray *value_array);
 
 void code_buff_init(CodeBuffer *code_buffer);
@@ -126,11 +397,35 @@ void print_value(CrispyValue value, bool new_line, bool print_quotation);
 
 void print_type(CrispyValue value);
 
-int cmp_values(CrispyValue first, CrispyValue second);
+/**
+ * Returns the name of an object type (e.g. for statistics).
+ * @param type the type.
+ * @return the lower case name.
+ */
+const char *object_type_name(ObjectType type);
+
+/**
+ * Checks two strings for equality.
+ * Interned strings are only compared by identity.
+ * @param first the first string.
+ * @param second the second string.
+ * @return true if both strings contain the same characters.
+ */
+bool strings_equal(ObjString *first, ObjString *second);
 
-int cmp_objects(Object *first, Object *second);
+/**
+ * Returns the length of any string object (string, rope or slice) without flattening it.
+ * @param string the string object.
+ * @return the length.
+ */
+size_t string_length(Object *string);
 
-int cmp_strings(ObjString *first, ObjString *second);
+/**
+ * Copies the characters of any string object (string, rope or slice) without flattening it.
+ * @param string the string object.
+ * @param dest the buffer, which has to hold at least string_length(string) chars.
+ */
+void copy_string_chars(Object *string, char *dest);
 
 /**
  * Creates a heap allocated string from any value.
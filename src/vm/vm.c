@@ -20,115 +20,276 @@
 
 static InterpretResult run(Vm *vm);
 
-void frames_init(FrameArray *frames) {
-    frames->count = 0;
-    frames->cap = 0;
-    frames->frame_pointers = NULL;
-}
+/**
+ * Retrieves a single character of a string without allocating.
+ * @param vm the current vm.
+ * @param string the string object (string, rope or slice).
+ * @param index the index.
+ * @param return_value the pointer, which will hold the single character string.
+ * @return false if the index is out of bounds.
+ */
+static inline bool string_get(Vm *vm, Object *string, int64_t index, CrispyValue *return_value) {
+    if (index < 0 || index >= string_length(string)) {
+        return false;
+    }
 
-void frames_free(FrameArray *frames) {
-    // initial call frame
-    call_frame_free(frames->frame_pointers[0]);
-    FREE_ARR(frames->frame_pointers);
-    frames_init(frames);
+    uint8_t c = (uint8_t) string_chars(vm, string)[index];
+    *return_value = create_object((Object *) vm->single_chars[c]);
+    return true;
 }
 
-void frames_write_at(FrameArray *frame_arr, uint32_t index, CallFrame *frame) {
-    if (index > frame_arr->cap) {
-        fprintf(stderr, "Invalid write in frame array");
-        exit(100);
+/**
+ * Compares two values, skipping the generic comparison for small integers.
+ * @param vm the current vm.
+ * @param first the first value.
+ * @param second the second value.
+ * @return the result of the comparison, see cmp_values.
+ */
+static inline int compare(Vm *vm, CrispyValue first, CrispyValue second) {
+    if (CHECK_INT(first) && CHECK_INT(second)) {
+        return (AS_INT(first) > AS_INT(second)) - (AS_INT(first) < AS_INT(second));
     }
 
-    if (index == frame_arr->cap) {
-        frame_arr->cap = GROW_CAP(frame_arr->cap);
-        frame_arr->frame_pointers = GROW_ARR(frame_arr->frame_pointers, CallFrame *, frame_arr->cap);
-    }
+    return cmp_values(vm, first, second);
+}
 
-    if (index >= frame_arr->count) {
-        ++frame_arr->count;
+void push_frame(Vm *vm, CallFrame *function) {
+    if (vm->frame_count >= FRAMES_MAX) {
+        fprintf(stderr, "Too many nested frames\n");
+        exit(100);
     }
 
-    frame_arr->frame_pointers[index] = frame;
+    Frame *frame = &vm->frames[vm->frame_count++];
+    frame->function = function;
+    frame->ip = NULL;
+    frame->slots = function->variables.values;
 }
 
 void vm_init(Vm *vm, bool interactive) {
+    slab_init(&vm->slabs);
+
+    vm->stack = malloc(STACK_MAX * sizeof(CrispyValue));
     vm->sp = vm->stack;
     vm->first_object = NULL;
+    vm->young_objects = NULL;
     vm->allocated_mem = 0;
-    vm->max_alloc_mem = INITIAL_GC_THRESHOLD;
+    vm->young_mem = 0;
+    vm->max_alloc_mem = MIN_HEAP;
+
+    vm->remembered.count = 0;
+    vm->remembered.cap = 0;
+    vm->remembered.objects = NULL;
+
+    vm->gray.count = 0;
+    vm->gray.cap = 0;
+    vm->gray.objects = NULL;
+
+    vm->unswept = NULL;
+    vm->background_sweep = BACKGROUND_SWEEP;
+    vm->sweeper = NULL;
+    vm->collected_heap = 0;
+    vm->live_mem = 0;
+    vm->compacting_gc = COMPACTING_GC;
+    vm->compaction_requested = false;
+
+    vm->gc_threads = GC_THREADS;
+    vm->gc_pool = NULL;
+    vm->parallel_marking = false;
+
+    vm->incremental_gc = INCREMENTAL_GC;
+    vm->gc_slice_budget = GC_SLICE_BUDGET;
+    vm->gc_phase = GC_PHASE_IDLE;
+    vm->clear_cursor = NULL;
+    memset(&vm->stats, 0, sizeof(GcStats));
+    memset(vm->surviving, 0, sizeof(vm->surviving));
+    vm->heap_growth = HEAP_GROWTH;
+    vm->min_heap = MIN_HEAP;
+    vm->max_heap = MAX_HEAP;
+    vm->heap_limit = HEAP_LIMIT != 0 ? HEAP_LIMIT : SIZE_MAX;
+    vm->heap_limit_exceeded = false;
+    vm->heap_limit_handler = NULL;
+    vm->cycle_start = now_ns();
+    vm->cycle_gc_time = 0;
+    vm->cycle_allocated = 0;
     vm->frame_count = 0;
     vm->interactive = interactive;
     vm->err_flag = false;
     vm->current_status = VM_STATUS_INIT;
 
-    FrameArray frames;
-    frames_init(&frames);
-    vm->frames = frames;
+    vm->frames = malloc(FRAMES_MAX * sizeof(Frame));
 
+    // the variables of the main program are accessed through a pointer, so they must never be reallocated.
+    // Variable indices are single bytes, which limits them to 256
     CallFrame *call_frame = new_call_frame();
-    frames_write_at(&vm->frames, vm->frame_count++, call_frame);
+    for (int i = 0; i <= UINT8_MAX; ++i) {
+        write_value(&call_frame->variables, create_nil());
+    }
+
+    push_frame(vm, call_frame);
 
     HashTable strings;
-    ht_init(&strings, HT_KEY_IDENT_STRING, 16, free_string_literal);
+    ht_init(&strings, HT_KEY_IDENT_STRING, 16, &vm->slabs);
     vm->strings = strings;
+
+    vm->root_shape = new_root_shape();
+
+    for (int i = 0; i < 256; ++i) {
+        char c = (char) i;
+        vm->single_chars[i] = new_interned_string(vm, &c, 1);
+        make_permanent((Object *) vm->single_chars[i]);
+    }
 }
 
-size_t free_object(Object *object) {
+void set_heap_limits(Vm *vm, double heap_growth, size_t min_heap, size_t max_heap) {
+    vm->heap_growth = heap_growth;
+    vm->min_heap = min_heap;
+    vm->max_heap = max_heap;
+
+    if (vm->max_alloc_mem < min_heap) {
+        vm->max_alloc_mem = min_heap;
+    }
+
+    if (max_heap != 0 && vm->max_alloc_mem > max_heap) {
+        vm->max_alloc_mem = max_heap;
+    }
+}
+
+void set_heap_limit(Vm *vm, size_t heap_limit) {
+    vm->heap_limit = heap_limit != 0 ? heap_limit : SIZE_MAX;
+
+    if (vm->max_alloc_mem > vm->heap_limit) {
+        vm->max_alloc_mem = vm->heap_limit;
+    }
+}
+
+size_t object_size(Object *object) {
     switch (object->type) {
         case OBJ_STRING: {
             ObjString *string = (ObjString *) object;
-            size_t length = string->length;
+            size_t size = sizeof(ObjString) + string->length * sizeof(char);
 
-            free((void *) string->start);
-            free(object);
-            return sizeof(ObjString) + length * sizeof(char);
+            // see add_interned
+            return string->interned ? size + sizeof(HTItem) : size;
         }
         case OBJ_LAMBDA: {
-            ObjLambda *lambda = (ObjLambda *) object;
-            call_frame_free(lambda->call_frame);
-            free(lambda);
-            // TODO size of callframe?
-            return sizeof(ObjLambda);
+            CallFrame *frame = ((ObjLambda *) object)->call_frame;
+            return sizeof(ObjLambda) + (frame != NULL ? call_frame_size(frame) : 0);
         }
-        case OBJ_NATIVE_FUNC: {
-            ObjNativeFunc *n_fn = (ObjNativeFunc *) object;
-            free(n_fn);
+        case OBJ_NATIVE_FUNC:
             return sizeof(ObjNativeFunc);
+        case OBJ_ROPE: {
+            // the buffer of a flattened rope is added to the heap size by flatten
+            ObjRope *rope = (ObjRope *) object;
+            return sizeof(ObjRope) + (rope->flat != NULL ? rope->length * sizeof(char) : 0);
         }
-        case OBJ_LIST: {
-            ObjList *list = (ObjList *) object;
-            val_arr_free(&list->content);
-            free(list);
+        case OBJ_SLICE:
+            return sizeof(ObjSlice);
+        case OBJ_LIST:
+            return sizeof(ObjList) + list_memory((ObjList *) object);
+        case OBJ_VECTOR_NODE:
+            return sizeof(ObjVectorNode);
+        case OBJ_DICT:
+            return sizeof(ObjDict) + dict_memory((ObjDict *) object);
+    }
+
+    return 0;
+}
+
+size_t allocation_size(Object *object) {
+    switch (object->type) {
+        case OBJ_STRING:
+            return sizeof(ObjString) + ((ObjString *) object)->length * sizeof(char);
+        case OBJ_LAMBDA:
+            return sizeof(ObjLambda);
+        case OBJ_NATIVE_FUNC:
+            return sizeof(ObjNativeFunc);
+        case OBJ_ROPE:
+            return sizeof(ObjRope);
+        case OBJ_SLICE:
+            return sizeof(ObjSlice);
+        case OBJ_LIST:
             return sizeof(ObjList);
-        }
-        case OBJ_DICT: {
-            ObjDict *dict = (ObjDict *) object;
-            ht_free(&dict->content);
-            free(dict);
+        case OBJ_VECTOR_NODE:
+            return sizeof(ObjVectorNode);
+        case OBJ_DICT:
             return sizeof(ObjDict);
-        }
     }
 
     return 0;
 }
 
+size_t free_object(Vm *vm, Object *object) {
+    size_t accounted = object_size(object);
+    size_t size = allocation_size(object);
+
+    switch (object->type) {
+        case OBJ_LAMBDA:
+            call_frame_free(((ObjLambda *) object)->call_frame);
+            break;
+        case OBJ_ROPE:
+            free(((ObjRope *) object)->flat);
+            break;
+        case OBJ_LIST:
+            list_free_content((ObjList *) object);
+            break;
+        case OBJ_DICT:
+            dict_free_content((ObjDict *) object);
+            break;
+        default:
+            break;
+    }
+
+    slab_free(&vm->slabs, object, size);
+    return accounted;
+}
+
 void vm_free(Vm *vm) {
-    frames_free(&vm->frames);
+    // the surviving objects are put back into the old generation, so that they are freed below
+    finish_sweep(vm);
+    stop_gc_threads(vm);
 
-    Object **obj = &vm->first_object;
+    call_frame_free(vm->frames[0].function);
+    free(vm->frames);
+    vm->frames = NULL;
+    vm->frame_count = 0;
 
-    while (*obj) {
-        Object *to_del = *obj;
-        *obj = to_del->next;
-        free_object(to_del);
+    Object *generations[] = {vm->first_object, vm->young_objects};
+
+    for (int i = 0; i < 2; ++i) {
+        Object *obj = generations[i];
+
+        while (obj) {
+            Object *to_del = obj;
+            obj = to_del->next;
+            free_object(vm, to_del);
+        }
     }
 
+    free(vm->stack);
+    vm->stack = NULL;
     vm->sp = NULL;
     vm->first_object = NULL;
+    vm->young_objects = NULL;
     vm->allocated_mem = 0;
+    vm->young_mem = 0;
     vm->max_alloc_mem = 0;
 
+    FREE_ARR(vm->remembered.objects);
+    vm->remembered.objects = NULL;
+    vm->remembered.count = 0;
+    vm->remembered.cap = 0;
+
+    FREE_ARR(vm->gray.objects);
+    vm->gray.objects = NULL;
+    vm->gray.count = 0;
+    vm->gray.cap = 0;
+
     ht_free(&vm->strings);
+
+    shape_free(vm->root_shape);
+    vm->root_shape = NULL;
+
+    slab_free_all(&vm->slabs);
 }
 
 void write_code_buffer(CodeBuffer *code_buffer, uint8_t instruction) {
@@ -147,6 +308,11 @@ uint32_t add_constant(Vm *vm, CrispyValue value) {
         exit(45);
     }
 
+    // constants never change, so they don't have to be traced by every collection
+    if (CHECK_OBJ(value)) {
+        make_permanent(AS_OBJ(value));
+    }
+
     write_value(&call_frame->constants, value);
     return (uint32_t) (call_frame->constants.count - 1);
 }
@@ -162,8 +328,9 @@ static void init_compiler(Compiler *compiler, const char *source) {
     compiler->next = scan_token(&compiler->scanner);
 
     VarHashTable ht;
-    var_ht_init(&ht, 16);
+    var_ht_init(&ht, 16, NULL);
     compiler->scope[0] = ht;
+    arena_init(&compiler->arena);
 
     compiler->scope_depth = 0;
     compiler->vars_in_scope = 0;
@@ -172,6 +339,7 @@ static void init_compiler(Compiler *compiler, const char *source) {
 
 static void free_compiler(Compiler *compiler) {
     var_ht_free(&compiler->scope[0]);
+    arena_free(&compiler->arena);
 }
 
 static void print_callframe(CallFrame *call_frame) {
@@ -193,6 +361,43 @@ static void panic(Vm *vm, const char *reason) {
     exit(44);
 }
 
+/**
+ * Removes the frames and values of the calls, that were interrupted by a runtime error.
+ * @param vm the current vm.
+ */
+static void unwind(Vm *vm) {
+    vm->frame_count = 1;
+    vm->sp = vm->stack;
+}
+
+/**
+ * Runs the main program and turns exceeding the heap limit into a runtime error.
+ * @param vm the current vm.
+ * @return the result of the program.
+ */
+static InterpretResult run_limited(Vm *vm) {
+    jmp_buf handler;
+
+    if (setjmp(handler)) {
+        vm->heap_limit_handler = NULL;
+        vm->current_status = VM_STATUS_RUNNING;
+        fprintf(stderr, "Out of memory: the heap limit of %zu bytes was exceeded\n", vm->heap_limit);
+
+        unwind(vm);
+        return INTERPRET_RUNTIME_ERROR;
+    }
+
+    vm->heap_limit_handler = &handler;
+    InterpretResult result = run(vm);
+    vm->heap_limit_handler = NULL;
+
+    if (result != INTERPRET_OK) {
+        unwind(vm);
+    }
+
+    return result;
+}
+
 InterpretResult interpret(Vm *vm, const char *source) {
     Compiler compiler;
     init_compiler(&compiler, source);
@@ -210,7 +415,7 @@ InterpretResult interpret(Vm *vm, const char *source) {
 
     CURR_FRAME(vm)->ip = CURR_FRAME(vm)->code_buffer.code;
     vm->current_status = VM_STATUS_RUNNING;
-    InterpretResult result = run(vm);
+    InterpretResult result = run_limited(vm);
     free_compiler(&vm->compiler);
 
     return result;
@@ -248,26 +453,111 @@ InterpretResult interpret_interactive(Vm *vm, const char *source) {
 
     CURR_FRAME(vm)->ip = CURR_FRAME(vm)->code_buffer.code;
     vm->current_status = VM_STATUS_RUNNING;
-    InterpretResult result = run(vm);
+    InterpretResult result = run_limited(vm);
 
     return result;
 }
 
-static InterpretResult run(Vm *vm) {
-    CallFrame *curr_frame = CURR_FRAME(vm);
+/**
+ * Looks up a key in a dictionary.
+ * All keys of dictionaries are interned, so if there is no interned string with the same content,
+ * the key can't be inside the dictionary.
+ * @param vm the current vm.
+ * @param dict the dictionary.
+ * @param key the key (string or rope).
+ * @return the value or nil.
+ */
+static CrispyValue dict_lookup(Vm *vm, ObjDict *dict, Object *key) {
+    ObjString *interned;
+
+    if (key->type == OBJ_STRING) {
+        interned = intern_string(vm, (ObjString *) key);
+    } else {
+        interned = find_interned(vm, string_chars(vm, key), string_length(key));
+
+        if (interned == NULL) {
+            return create_nil();
+        }
+    }
+
+    return dict_get(dict, interned);
+}
+
+#if DEBUG_TRACE_EXECUTION || DEBUG_TYPE_CHECK
+
+/**
+ * Prints the state of the interpreter and checks the stack before an instruction is executed.
+ * @param vm the current vm.
+ * @param sp the current stack pointer.
+ * @param ip the address of the next instruction.
+ * @param code the code of the current frame.
+ * @return false if the stack is corrupted.
+ */
+static bool debug_instruction(Vm *vm, CrispyValue *sp, uint8_t *ip, uint8_t *code) {
+    long stack_size = sp - vm->stack;
+
+#if DEBUG_TRACE_EXECUTION
+    printf("-----\n");
+    for (int i = 0; i < stack_size; ++i) {
+        printf("[%d] ", i);
+        print_value(vm->stack[i], false, true);
+        print_type(vm->stack[i]);
+    }
+    printf("sp: %li\n", stack_size);
+    printf("ip: %li\n", ip - code);
+    disassemble_instruction(vm, (int) (ip - code));
+    printf("-----\n");
+#else
+    // only the trace prints the instruction
+    (void) ip;
+    (void) code;
+#endif
+
+#if DEBUG_TYPE_CHECK
+    if (stack_size < 0) {
+        printf("Negative stack pointer\n");
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+#endif
+
+#if THREADED_DISPATCH
+// labels as values are a GNU extension and the table overrides its default entry for every instruction
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#pragma GCC diagnostic ignored "-Woverride-init"
+#endif
 
-    register uint8_t *ip = curr_frame->ip;
+static InterpretResult run(Vm *vm) {
+    register uint8_t *ip = CURR_FRAME(vm)->ip;
     register CrispyValue *sp = vm->sp;
-    register uint8_t *code = curr_frame->code_buffer.code;
+    register uint8_t *code;
 
-    CrispyValue *const_values = curr_frame->constants.values;
-    ValueArray *variables = &curr_frame->variables;
+    CrispyValue *const_values;
+    InlineCache *caches;
+    CrispyValue *slots;
+
+    // calls and returns only switch these registers to a different frame
+#define LOAD_FRAME()                                            \
+    do {                                                        \
+        Frame *frame = &vm->frames[vm->frame_count - 1];        \
+        code = frame->function->code_buffer.code;               \
+        const_values = frame->function->constants.values;       \
+        caches = frame->function->caches.caches;                \
+        slots = frame->slots;                                   \
+    } while (false)
+
+    LOAD_FRAME();
 
 #define READ_BYTE() (ip += 1, ip[-1])
 #define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
 #define READ_CONST() (const_values[READ_BYTE()])
 #define READ_CONST_W() (ip += 2, const_values[(ip[-2] << 8) | ip[-1]])
-#define READ_VAR() (variables->values[READ_BYTE()])
+#define READ_VAR() (slots[READ_BYTE()])
 #define POP() (*(sp -= 1))
 #define PUSH(value) (*sp = (value), sp += 1)
 #define PEEK() (*(sp - 1))
@@ -275,83 +565,159 @@ static InterpretResult run(Vm *vm) {
     do {                                                        \
         CrispyValue second = POP();                             \
         CrispyValue first = POP();                              \
+        if (CHECK_INT(first) && CHECK_INT(second)) {            \
+            PUSH(create_int(AS_INT(first) op AS_INT(second)));  \
+            break;                                              \
+        }                                                       \
         if (!CHECK_NUM(first) || !CHECK_NUM(second))            \
             goto ERROR;                                         \
-        first.d_value = first.d_value op second.d_value;        \
-        PUSH(first);                                            \
+        PUSH(create_number(AS_NUM(first) op AS_NUM(second)));   \
     } while (false)
 
 #define COND_JUMP(op)                                           \
     do {                                                        \
         CrispyValue second = POP();                             \
         CrispyValue first = POP();                              \
-        if (first.p_value op second.p_value) {                  \
+        if (compare(vm, first, second) op 0) {                      \
             ip = code + READ_SHORT();                           \
         } else {                                                \
             READ_SHORT();                                       \
         }                                                       \
     } while(false)
 
-    while (true) {
-        OP_CODE instruction;
-
-#if DEBUG_TRACE_EXECUTION
-        {
-            printf("-----\n");
-            long stack_size = sp - vm->stack;
-            for (int i = 0; i < stack_size; ++i) {
-                printf("[%d] ", i);
-                print_value(vm->stack[i], false, true);
-                print_type(vm->stack[i]);
-            }
-            printf("sp: %li\n", stack_size);
-            printf("ip: %li\n", ip - code);
-            disassemble_instruction(vm, (int) (ip - code));
-            printf("-----\n");
-        }
+#if DEBUG_TRACE_EXECUTION || DEBUG_TYPE_CHECK
+#define DEBUG_INSTRUCTION() if (!debug_instruction(vm, sp, ip, code)) goto ERROR
+#else
+#define DEBUG_INSTRUCTION() ((void) 0)
 #endif
 
-#if DEBUG_TYPE_CHECK
-        {
-            long stack_size = sp - vm->stack;
-            if (stack_size < 0) {
-                printf("Negative stack pointer\n");
-                goto ERROR;
-            }
-        }
+#if THREADED_DISPATCH
+    // every handler jumps to the next one on its own, so each jump can be predicted separately
+    static void *dispatch_table[256] = {
+            [0 ... 255] = &&UNKNOWN_INSTRUCTION,
+            [OP_NOP] = &&DO_OP_NOP,
+            [OP_TRUE] = &&DO_OP_TRUE,
+            [OP_FALSE] = &&DO_OP_FALSE,
+            [OP_NIL] = &&DO_OP_NIL,
+            [OP_ADD] = &&DO_OP_ADD,
+            [OP_SUB] = &&DO_OP_SUB,
+            [OP_MUL] = &&DO_OP_MUL,
+            [OP_DIV] = &&DO_OP_DIV,
+            [OP_MOD] = &&DO_OP_MOD,
+            [OP_POW] = &&DO_OP_POW,
+            [OP_AND] = &&DO_OP_AND,
+            [OP_OR] = &&DO_OP_OR,
+            [OP_EQUAL] = &&DO_OP_EQUAL,
+            [OP_NOT_EQUAL] = &&DO_OP_NOT_EQUAL,
+            [OP_GT] = &&DO_OP_GT,
+            [OP_LT] = &&DO_OP_LT,
+            [OP_GE] = &&DO_OP_GE,
+            [OP_LE] = &&DO_OP_LE,
+            [OP_LDC] = &&DO_OP_LDC,
+            [OP_LDC_W] = &&DO_OP_LDC_W,
+            [OP_LDC_0] = &&DO_OP_LDC_0,
+            [OP_LDC_1] = &&DO_OP_LDC_1,
+            [OP_STORE] = &&DO_OP_STORE,
+            [OP_LOAD] = &&DO_OP_LOAD,
+            [OP_LOAD_OFFSET] = &&DO_OP_LOAD_OFFSET,
+            [OP_STORE_OFFSET] = &&DO_OP_STORE_OFFSET,
+            [OP_DUP] = &&DO_OP_DUP,
+            [OP_POP] = &&DO_OP_POP,
+            [OP_CALL] = &&DO_OP_CALL,
+            [OP_NEGATE] = &&DO_OP_NEGATE,
+            [OP_NOT] = &&DO_OP_NOT,
+            [OP_PRINT] = &&DO_OP_PRINT,
+            [OP_DICT_NEW] = &&DO_OP_DICT_NEW,
+            [OP_LIST_NEW] = &&DO_OP_LIST_NEW,
+            [OP_LIST_APPEND] = &&DO_OP_LIST_APPEND,
+            [OP_STRUCT_SET] = &&DO_OP_STRUCT_SET,
+            [OP_STRUCT_GET] = &&DO_OP_STRUCT_GET,
+            [OP_STRUCT_PEEK] = &&DO_OP_STRUCT_PEEK,
+            [OP_GET_FIELD] = &&DO_OP_GET_FIELD,
+            [OP_SET_FIELD] = &&DO_OP_SET_FIELD,
+            [OP_JMP] = &&DO_OP_JMP,
+            [OP_JEQ] = &&DO_OP_JEQ,
+            [OP_JMT] = &&DO_OP_JMT,
+            [OP_JMF] = &&DO_OP_JMF,
+            [OP_JNE] = &&DO_OP_JNE,
+            [OP_JLT] = &&DO_OP_JLT,
+            [OP_JLE] = &&DO_OP_JLE,
+            [OP_JGT] = &&DO_OP_JGT,
+            [OP_JGE] = &&DO_OP_JGE,
+            [OP_INC_1] = &&DO_OP_INC_1,
+            [OP_DEC_1] = &&DO_OP_DEC_1,
+            [OP_RETURN] = &&DO_OP_RETURN,
+    };
+
+#define CASE(op) case op: DO_##op
+#define NEXT()                                                          \
+    do {                                                                \
+        DEBUG_INSTRUCTION();                                            \
+        goto *dispatch_table[instruction = (OP_CODE) READ_BYTE()];      \
+    } while (false)
+#else
+#define CASE(op) case op
+#define NEXT() break
 #endif
 
+    OP_CODE instruction;
+
+    while (true) {
+        DEBUG_INSTRUCTION();
+
         switch (instruction = (OP_CODE) READ_BYTE()) {
-            case OP_RETURN:
-                return INTERPRET_OK;
-            case OP_LDC:
+            CASE(OP_RETURN): {
+                if (vm->frame_count == 1) {
+                    return INTERPRET_OK;
+                }
+
+                // the result replaces the lambda and its variables
+                CrispyValue result = POP();
+                sp = slots - 1;
+                PUSH(result);
+
+                --vm->frame_count;
+                ip = vm->frames[vm->frame_count - 1].ip;
+                LOAD_FRAME();
+                NEXT();
+            }
+            CASE(OP_LDC):
                 PUSH(READ_CONST());
-                break;
-            case OP_LDC_W: {
+                NEXT();
+            CASE(OP_LDC_W): {
                 PUSH(READ_CONST_W());
-                break;
+                NEXT();
             }
-            case OP_LDC_0: {
-                CrispyValue zero = create_number(0.0);
+            CASE(OP_LDC_0): {
+                CrispyValue zero = create_int(0);
                 PUSH(zero);
-                break;
+                NEXT();
             }
-            case OP_LDC_1: {
-                CrispyValue one = create_number(1.0);
+            CASE(OP_LDC_1): {
+                CrispyValue one = create_int(1);
                 PUSH(one);
-                break;
+                NEXT();
             }
-            case OP_CALL: {
+            CASE(OP_CALL): {
+                if (vm->compaction_requested) {
+                    vm->sp = sp;
+                    compact_heap(vm);
+                }
+
+                if (vm->heap_limit_exceeded) {
+                    vm->sp = sp;
+                    check_heap_limit(vm, 0);
+                }
+
                 uint8_t num_args = READ_BYTE();
                 CrispyValue *pos = (sp - num_args - 1);
 
-                if (pos->type != OBJECT) {
+                if (!CHECK_OBJ(*pos)) {
                     fprintf(stderr, "Trying to call primitive CrispyValue\n");
                     goto ERROR;
                 }
 
-                Object *object = pos->o_value;
-                object->marked = true;
+                Object *object = AS_OBJ(*pos);
 
                 if (object->type == OBJ_NATIVE_FUNC) {
                     ObjNativeFunc *n_fn = (ObjNativeFunc *) object;
@@ -362,14 +728,8 @@ static InterpretResult run(Vm *vm) {
                         goto ERROR;
                     }
 
-                    // Pop arguments from stack
-                    CrispyValue args[num_args];
-                    CrispyValue *start = sp - num_args;
-
-                    for (int i = 0; i < num_args; ++i) {
-                        args[i] = *(start++);
-                        --sp;
-                    }
+                    // the arguments stay on the stack, until the native function returns
+                    CrispyValue *args = sp - num_args;
 
                     CrispyValue res;
                     if (n_fn->system_func) {
@@ -391,11 +751,11 @@ static InterpretResult run(Vm *vm) {
                         res = ((CrispyValue (*)(CrispyValue *)) n_fn->func_ptr)(args);
                     }
 
-                    // pop
-                    --sp;
+                    // pop the arguments and the function
+                    sp = args - 1;
 
                     PUSH(res);
-                    break;
+                    NEXT();
                 }
 
                 if (object->type != OBJ_LAMBDA) {
@@ -410,74 +770,89 @@ static InterpretResult run(Vm *vm) {
                     goto ERROR;
                 }
 
-                // Pop arguments from stack
-                CrispyValue args[num_args];
-                for (int i = 0; i < num_args; ++i) {
-                    args[i] = POP();
-                }
-
-                // Create a temp callframe with its own var array
-                // otherwise recursion would override the variables of its predecessors on the callstack
-                CallFrame *call_frame = new_temp_call_frame(lambda->call_frame);
+                // the arguments become the first variables of the lambda
+                CrispyValue *arguments = sp - num_args;
+                CrispyValue *locals_end = arguments + lambda->call_frame->local_count;
 
-                PUSH_FRAME(vm, call_frame);
-                CrispyValue *before_sp = sp;
-
-                for (int i = 0; i < num_args; ++i) {
-                    PUSH(args[i]);
+                if (vm->frame_count >= FRAMES_MAX || locals_end + FRAME_STACK_RESERVE > vm->stack + STACK_MAX) {
+                    fprintf(stderr, "Stack overflow\n");
+                    goto ERROR;
                 }
 
-                vm->sp = sp;
-                InterpretResult result = run(vm);
+                // the other variables must not hold stale objects, because the gc scans them as part of the stack
+                while (sp < locals_end) {
+                    PUSH(create_nil());
+                }
 
-                // free temp callframe
-                temp_call_frame_free(POP_FRAME(vm));
+                vm->frames[vm->frame_count - 1].ip = ip;
 
-                if (result != INTERPRET_OK) {
-                    return result;
-                }
+                Frame *callee = &vm->frames[vm->frame_count++];
+                callee->function = lambda->call_frame;
+                callee->slots = arguments;
 
-                sp = before_sp;
-                break;
+                ip = lambda->call_frame->ip;
+                LOAD_FRAME();
+                NEXT();
             }
-            case OP_ADD: {
-                CrispyValue second = POP();
-                CrispyValue first = POP();
+            CASE(OP_ADD): {
+                // the operands stay on the stack until the result is allocated, so the gc can see them
+                CrispyValue second = PEEK();
+                CrispyValue first = sp[-2];
+
+                if (CHECK_INT(first) && CHECK_INT(second)) {
+                    sp -= 2;
+                    PUSH(create_int(AS_INT(first) + AS_INT(second)));
+                    NEXT();
+                }
 
-                if (first.type == NUMBER && second.type == NUMBER) {
-                    first.d_value += second.d_value;
-                    PUSH(first);
-                    break;
+                if (CHECK_NUM(first) && CHECK_NUM(second)) {
+                    sp -= 2;
+                    PUSH(create_number(AS_NUM(first) + AS_NUM(second)));
+                    NEXT();
                 }
 
-                if (first.type == OBJECT) {
-                    Object *first_obj = first.o_value;
-                    first_obj->marked = true;
+                if (CHECK_OBJ(first)) {
+                    Object *first_obj = AS_OBJ(first);
+                    vm->sp = sp;
 
                     switch (first_obj->type) {
-                        case OBJ_STRING: {
-                            if (second.type != OBJECT || second.o_value->type != OBJ_STRING) {
+                        case OBJ_STRING:
+                        case OBJ_ROPE:
+                        case OBJ_SLICE: {
+                            if (!CHECK_STRING(second)) {
                                 fprintf(stderr,
                                         "Only strings can be appended to strings. Consider using the 'str' function\n");
                                 goto ERROR;
                             }
-                            ObjString *first_str = (ObjString *) first_obj;
-                            ObjString *second_str = (ObjString *) second.o_value;
-                            second_str->object.marked = true;
-
-                            ObjString *dest = new_empty_string(vm, (first_str->length + second_str->length));
-
-                            memcpy((char *) dest->start, first_str->start, first_str->length);
-                            memcpy((char *) (dest->start + first_str->length), second_str->start, second_str->length);
+                            Object *second_obj = AS_OBJ(second);
+                            size_t first_length = string_length(first_obj);
+                            size_t second_length = string_length(second_obj);
+
+                            Object *dest;
+
+                            if (first_length + second_length >= MIN_ROPE_LENGTH) {
+                                // defer the copying until the characters are actually needed
+                                dest = (Object *) new_rope(vm, first_obj, second_obj);
+                            } else {
+                                ObjString *dest_str = new_empty_string(vm, first_length + second_length);
+
+                                copy_string_chars(first_obj, dest_str->chars);
+                                copy_string_chars(second_obj, dest_str->chars + first_length);
+#if INTERN_ON_CREATION
+                                dest_str = intern_string(vm, dest_str);
+#endif
+                                dest = (Object *) dest_str;
+                            }
 
-                            PUSH(create_object((Object *) dest));
+                            sp -= 2;
+                            PUSH(create_object(dest));
                             break;
                         }
                         case OBJ_LIST: {
-                            ObjList *clone = clone_list(vm, (ObjList *) first_obj);
-                            list_append(clone, second);
+                            ObjList *result = new_appended_list(vm, (ObjList *) first_obj, second);
 
-                            PUSH(create_object((Object *) clone));
+                            sp -= 2;
+                            PUSH(create_object((Object *) result));
                             break;
                         }
                         default:
@@ -489,45 +864,78 @@ static InterpretResult run(Vm *vm) {
                     goto ERROR;
                 }
 
-                break;
+                NEXT();
             }
-            case OP_SUB:
+            CASE(OP_SUB):
                 BINARY_OP(-);
-                break;
-            case OP_MUL:
-                BINARY_OP(*);
-                break;
-            case OP_MOD: {
+                NEXT();
+            CASE(OP_MUL): {
                 CrispyValue second = POP();
                 CrispyValue first = POP();
 
-                if (first.type != NUMBER || second.type != NUMBER) {
+                if (!CHECK_NUM(first) || !CHECK_NUM(second)) {
+                    goto ERROR;
+                }
+
+                double product = AS_NUM(first) * AS_NUM(second);
+
+                // the product of two small integers can overflow an int64_t, so the range is checked on the double first.
+                // A negative zero (e.g. 0 * -1) can only be represented as double
+                if (CHECK_INT(first) && CHECK_INT(second) && fabs(product) <= SMALL_INT_MAX
+                    && !(product == 0 && signbit(product))) {
+                    PUSH(create_int(AS_INT(first) * AS_INT(second)));
+                } else {
+                    PUSH(create_number(product));
+                }
+                NEXT();
+            }
+            CASE(OP_MOD): {
+                CrispyValue second = POP();
+                CrispyValue first = POP();
+
+                if (CHECK_INT(first) && CHECK_INT(second) && AS_INT(second) != 0) {
+                    PUSH(create_int(AS_INT(first) % AS_INT(second)));
+                    NEXT();
+                }
+
+                if (!CHECK_NUM(first) || !CHECK_NUM(second)) {
                     fprintf(stderr, "Modulo operator (%%) only works on numbers\n");
                     goto ERROR;
                 }
 
-                int64_t first_int = (int64_t) first.d_value;
-                int64_t second_int = (int64_t) second.d_value;
+                int64_t first_int = (int64_t) AS_NUM(first);
+                int64_t second_int = (int64_t) AS_NUM(second);
 
-                PUSH(create_number(first_int % second_int));
-                break;
+                if (second_int == 0) {
+                    fprintf(stderr, "Cannot divide by zero\n");
+                    goto ERROR;
+                }
+
+                PUSH(create_int(first_int % second_int));
+                NEXT();
             }
-            case OP_DIV: {
+            CASE(OP_DIV): {
                 CrispyValue second = POP();
                 CrispyValue first = POP();
                 if (!CHECK_NUM(first) || !CHECK_NUM(second)) {
                     goto ERROR;
                 }
 
-                if (second.d_value == 0) {
+                if (AS_NUM(second) == 0) {
                     panic(vm, "Cannot divide by zero\n");
                 }
 
-                first.d_value = first.d_value / second.d_value;
-                PUSH(first);
-                break;
+                // only exact quotients stay integers (0 / -1 is a negative zero)
+                if (CHECK_INT(first) && CHECK_INT(second) && AS_INT(first) % AS_INT(second) == 0
+                    && (AS_INT(first) != 0 || AS_INT(second) > 0)) {
+                    PUSH(create_int(AS_INT(first) / AS_INT(second)));
+                    NEXT();
+                }
+
+                PUSH(create_number(AS_NUM(first) / AS_NUM(second)));
+                NEXT();
             }
-            case OP_POW: {
+            CASE(OP_POW): {
                 CrispyValue exponent = POP();
                 CrispyValue base = POP();
 
@@ -535,120 +943,136 @@ static InterpretResult run(Vm *vm) {
                     goto ERROR;
                 }
 
-                PUSH(create_number(pow(base.d_value, exponent.d_value)));
+                PUSH(create_number(pow(AS_NUM(base), AS_NUM(exponent))));
 
-                break;
+                NEXT();
             }
-            case OP_OR: {
+            CASE(OP_OR): {
                 CrispyValue second = POP();
                 CrispyValue first = POP();
 
-                if (first.type != BOOLEAN || second.type != BOOLEAN) {
+                if (!CHECK_BOOL(first) || !CHECK_BOOL(second)) {
                     goto ERROR;
                 }
 
-                PUSH(create_bool(first.p_value || second.p_value));
+                PUSH(create_bool(AS_BOOL(first) || AS_BOOL(second)));
 
-                break;
+                NEXT();
             }
-            case OP_AND: {
+            CASE(OP_AND): {
                 CrispyValue second = POP();
                 CrispyValue first = POP();
 
-                if (first.type != BOOLEAN || second.type != BOOLEAN) {
+                if (!CHECK_BOOL(first) || !CHECK_BOOL(second)) {
                     goto ERROR;
                 }
 
-                PUSH(create_bool(first.p_value && second.p_value));
+                PUSH(create_bool(AS_BOOL(first) && AS_BOOL(second)));
 
-                break;
+                NEXT();
             }
-            case OP_EQUAL: {
+            CASE(OP_EQUAL): {
                 CrispyValue second = POP();
                 CrispyValue first = POP();
-                PUSH(create_bool(cmp_values(first, second) == 0));
-                break;
+                PUSH(create_bool(values_equal(vm, first, second)));
+                NEXT();
             }
-            case OP_NOT_EQUAL: {
+            CASE(OP_NOT_EQUAL): {
                 CrispyValue second = POP();
                 CrispyValue first = POP();
-                PUSH(create_bool(cmp_values(first, second) != 0));
-                break;
+                PUSH(create_bool(!values_equal(vm, first, second)));
+                NEXT();
             }
-            case OP_GE: {
+            CASE(OP_GE): {
                 // TODO exception for non orderable type (e.g nil)
                 CrispyValue second = POP();
                 CrispyValue first = POP();
-                PUSH(create_bool(cmp_values(first, second) >= 0));
-                break;
+                PUSH(create_bool(compare(vm, first, second) >= 0));
+                NEXT();
             }
-            case OP_LE: {
+            CASE(OP_LE): {
                 CrispyValue second = POP();
                 CrispyValue first = POP();
-                PUSH(create_bool(cmp_values(first, second) <= 0));
-                break;
+                PUSH(create_bool(compare(vm, first, second) <= 0));
+                NEXT();
             }
-            case OP_GT: {
+            CASE(OP_GT): {
                 CrispyValue second = POP();
                 CrispyValue first = POP();
-                PUSH(create_bool(cmp_values(first, second) > 0));
-                break;
+                PUSH(create_bool(compare(vm, first, second) > 0));
+                NEXT();
             }
-            case OP_LT: {
+            CASE(OP_LT): {
                 CrispyValue second = POP();
                 CrispyValue first = POP();
-                PUSH(create_bool(cmp_values(first, second) < 0));
-                break;
+                PUSH(create_bool(compare(vm, first, second) < 0));
+                NEXT();
             }
-            case OP_NEGATE: {
-                CrispyValue val = create_number(POP().d_value * -1);
-                PUSH(val);
-                break;
+            CASE(OP_NEGATE): {
+                CrispyValue val = POP();
+
+                // -0 can only be represented as double
+                if (CHECK_INT(val) && AS_INT(val) != 0) {
+                    PUSH(create_int(-AS_INT(val)));
+                    NEXT();
+                }
+
+                PUSH(create_number(AS_NUM(val) * -1));
+                NEXT();
             }
-            case OP_LOAD: {
+            CASE(OP_LOAD): {
                 CrispyValue val = READ_VAR();
                 PUSH(val);
-                break;
+                NEXT();
             }
-            case OP_LOAD_OFFSET: {
+            CASE(OP_LOAD_OFFSET): {
                 uint8_t scope = READ_BYTE();
                 uint8_t index = READ_BYTE();
 
-                CallFrame *frame = FRAME_AT(vm, scope);
-                CrispyValue val = frame->variables.values[index];
+                CrispyValue val = FRAME_AT(vm, scope)->slots[index];
 
                 PUSH(val);
 
-                break;
+                NEXT();
             }
-            case OP_STORE_OFFSET: {
+            CASE(OP_STORE_OFFSET): {
                 uint8_t scope = READ_BYTE();
                 uint8_t index = READ_BYTE();
 
-                CallFrame *frame = FRAME_AT(vm, scope);
                 CrispyValue val = POP();
 
-                frame->variables.values[index] = val;
-                break;
+                FRAME_AT(vm, scope)->slots[index] = val;
+                NEXT();
             }
-            case OP_STORE: {
+            CASE(OP_STORE): {
                 uint8_t index = READ_BYTE();
                 CrispyValue val = POP();
-                write_at(variables, index, val);
-                break;
+                slots[index] = val;
+                NEXT();
             }
-            case OP_POP:
+            CASE(OP_POP):
                 --sp;
-                break;
-            case OP_DUP: {
+                NEXT();
+            CASE(OP_DUP): {
                 CrispyValue val = PEEK();
                 PUSH(val);
-                break;
+                NEXT();
             }
-            case OP_JMP:
+            CASE(OP_JMP):
+                // calls and jumps (which close every loop) are the safe points, at which objects may be moved
+                if (vm->compaction_requested) {
+                    vm->sp = sp;
+                    compact_heap(vm);
+                }
+
+                if (vm->heap_limit_exceeded) {
+                    vm->sp = sp;
+                    check_heap_limit(vm, 0);
+                }
+
                 ip = code + READ_SHORT();
-                break;
-            case OP_JMT: {
+                NEXT();
+            CASE(OP_JMT): {
                 CrispyValue value = POP();
                 if (!CHECK_BOOL(value)) { goto ERROR; }
                 if (BOOL_TRUE(value)) {
@@ -656,9 +1080,9 @@ static InterpretResult run(Vm *vm) {
                 } else {
                     ip += 2;
                 }
-                break;
+                NEXT();
             }
-            case OP_JMF: {
+            CASE(OP_JMF): {
                 CrispyValue value = POP();
                 if (!CHECK_BOOL(value)) { goto ERROR; }
                 if (!BOOL_TRUE(value)) {
@@ -666,139 +1090,154 @@ static InterpretResult run(Vm *vm) {
                 } else {
                     ip += 2;
                 }
-                break;
+                NEXT();
             }
-            case OP_JEQ:
+            CASE(OP_JEQ):
                 COND_JUMP(==);
-                break;
-            case OP_JNE:
+                NEXT();
+            CASE(OP_JNE):
                 COND_JUMP(!=);
-                break;
-            case OP_JLT:
+                NEXT();
+            CASE(OP_JLT):
                 COND_JUMP(<);
-                break;
-            case OP_JLE:
+                NEXT();
+            CASE(OP_JLE):
                 COND_JUMP(<=);
-                break;
-            case OP_JGT:
+                NEXT();
+            CASE(OP_JGT):
                 COND_JUMP(>);
-                break;
-            case OP_JGE:
+                NEXT();
+            CASE(OP_JGE):
                 COND_JUMP(>=);
-                break;
-            case OP_INC_1: {
+                NEXT();
+            CASE(OP_INC_1): {
                 uint8_t index = READ_BYTE();
-                ++variables->values[index].d_value;
-                break;
+                CrispyValue *var = &slots[index];
+                *var = CHECK_INT(*var) ? create_int(AS_INT(*var) + 1) : create_number(AS_NUM(*var) + 1);
+                NEXT();
             }
-            case OP_DEC_1: {
+            CASE(OP_DEC_1): {
                 uint8_t index = READ_BYTE();
-                --variables->values[index].d_value;
-                break;
+                CrispyValue *var = &slots[index];
+                *var = CHECK_INT(*var) ? create_int(AS_INT(*var) - 1) : create_number(AS_NUM(*var) - 1);
+                NEXT();
             }
-            case OP_NOT: {
+            CASE(OP_NOT): {
                 CrispyValue value = POP();
 
-                if (value.type != BOOLEAN) {
+                if (!CHECK_BOOL(value)) {
                     goto ERROR;
                 }
 
-                value.p_value = value.p_value == 0 ? 1 : 0;
-                PUSH(value);
-                break;
+                PUSH(create_bool(!AS_BOOL(value)));
+                NEXT();
             }
-            case OP_TRUE:
+            CASE(OP_TRUE):
                 PUSH(create_bool(true));
-                break;
-            case OP_FALSE:
+                NEXT();
+            CASE(OP_FALSE):
                 PUSH(create_bool(false));
-                break;
-            case OP_NOP:
+                NEXT();
+            CASE(OP_NOP):
                 PUSH(create_bool(false));
-                break;
-            case OP_NIL:
+                NEXT();
+            CASE(OP_NIL):
                 PUSH(create_nil());
-                break;
-            case OP_PRINT: {
+                NEXT();
+            CASE(OP_PRINT): {
                 CrispyValue value = POP();
                 printf("> ");
                 print_value(value, true, true);
-                break;
+                NEXT();
             }
-            case OP_DICT_NEW: {
-                HashTable content;
-                ht_init(&content, HT_KEY_OBJSTRING, 8, free_objstring);
-
-                ObjDict *dict = new_dict(vm, content);
+            CASE(OP_DICT_NEW): {
+                vm->sp = sp;
+                ObjDict *dict = new_dict(vm);
                 CrispyValue value = create_object((Object *) dict);
                 PUSH(value);
-                break;
+                NEXT();
             }
-            case OP_LIST_NEW: {
+            CASE(OP_LIST_NEW): {
+                // the lists of the enclosing literals are only referenced by the stack
+                vm->sp = sp;
                 ObjList *list = new_list(vm, 0);
                 CrispyValue list_val = create_object((Object *) list);
 
                 PUSH(list_val);
-                break;
+                NEXT();
             }
-            case OP_LIST_APPEND: {
+            CASE(OP_LIST_APPEND): {
                 CrispyValue value = POP();
                 CrispyValue list_val = PEEK();
 
-                if (list_val.type != OBJECT || list_val.o_value->type != OBJ_LIST) {
+                if (!CHECK_OBJ_TYPE(list_val, OBJ_LIST)) {
                     fprintf(stderr, "Can only put values into lists\n");
                     goto ERROR;
                 }
 
-                ObjList *list = (ObjList *) list_val.o_value;
+                ObjList *list = (ObjList *) AS_OBJ(list_val);
+
+                write_barrier(vm, (Object *) list, value);
 
+                size_t old_size = list_memory(list);
                 list_append(list, value);
-                break;
+                track_memory(vm, old_size, list_memory(list));
+                NEXT();
             }
-            case OP_STRUCT_SET: {
+            CASE(OP_STRUCT_SET): {
                 CrispyValue value = POP();
                 CrispyValue key = POP();
                 CrispyValue structure = PEEK();
 
-                if (structure.type != OBJECT) {
+                if (!CHECK_OBJ(structure)) {
                     fprintf(stderr, "Trying to retrieve an element from a primitive value\n");
                     goto ERROR;
                 }
 
-                Object *obj = structure.o_value;
+                Object *obj = AS_OBJ(structure);
 
                 switch (obj->type) {
                     case OBJ_DICT: {
                         ObjDict *dict = (ObjDict *) obj;
 
-                        if (key.type != OBJECT) {
+                        if (!CHECK_OBJ(key)) {
                             fprintf(stderr, "Only strings can be used as indices for dictionaries\n");
                             goto ERROR;
                         }
 
-                        HTItemKey ht_key;
-                        Object *key_obj = key.o_value;
+                        Object *key_obj = AS_OBJ(key);
 
-                        if (key_obj->type != OBJ_STRING) {
+                        if (!IS_STRING_OBJ(key_obj)) {
                             fprintf(stderr, "Only strings can be used as indices for dictionaries\n");
                             goto ERROR;
                         }
 
-                        ht_key.key_obj_string = (ObjString *) key_obj;
-                        ht_put(&dict->content, ht_key, value);
+                        ObjString *interned = intern_string_obj(vm, key_obj);
+
+                        // hash table dictionaries also reference their keys
+                        write_barrier(vm, obj, create_object((Object *) interned));
+                        write_barrier(vm, obj, value);
+
+                        size_t old_size = dict_memory(dict);
+                        dict_put(dict, interned, value, &vm->slabs);
+                        track_memory(vm, old_size, dict_memory(dict));
                         break;
                     }
                     case OBJ_LIST: {
                         ObjList *list = (ObjList *) obj;
 
-                        // Check if key is an integer
-                        if (key.type != NUMBER || floor(key.d_value) != key.d_value) {
+                        int64_t index;
+                        if (!to_index(key, &index)) {
                             fprintf(stderr, "Only integers can be used as indices for lists\n");
                             goto ERROR;
                         }
 
-                        int64_t index = (int64_t) key.d_value;
+                        write_barrier(vm, obj, value);
+
+                        // changing the storage of the list might change its size
+                        size_t old_size = list_memory(list);
                         bool success = list_add(list, index, value);
+                        track_memory(vm, old_size, list_memory(list));
 
                         if (!success) {
                             fprintf(stderr, "Index out of bounds\n");
@@ -812,54 +1251,47 @@ static InterpretResult run(Vm *vm) {
                         goto ERROR;
                 }
 
-                break;
+                NEXT();
             }
-            case OP_STRUCT_GET: {
+            CASE(OP_STRUCT_GET): {
                 CrispyValue key_val = POP();
                 CrispyValue struct_val = POP();
 
-                if (struct_val.type != OBJECT) {
+                if (!CHECK_OBJ(struct_val)) {
                     fprintf(stderr, "Trying to retrieve an element from a primitive value\n");
                     goto ERROR;
                 }
 
-                Object *obj = struct_val.o_value;
+                Object *obj = AS_OBJ(struct_val);
 
                 switch (obj->type) {
                     case OBJ_DICT: {
-                        if (key_val.type != OBJECT) {
+                        if (!CHECK_OBJ(key_val)) {
                             fprintf(stderr, "Only strings can be used as indices for dictionaries\n");
                             goto ERROR;
                         }
 
 
                         ObjDict *dict = (ObjDict *) obj;
-                        Object *key_obj = key_val.o_value;
+                        Object *key_obj = AS_OBJ(key_val);
 
-                        if (key_obj->type != OBJ_STRING) {
+                        if (!IS_STRING_OBJ(key_obj)) {
                             fprintf(stderr, "Only strings can be used as indices for dictionaries\n");
                             goto ERROR;
                         }
 
-                        ObjString *key_string = (ObjString *) key_obj;
-
-                        HTItemKey key;
-                        key.key_obj_string = key_string;
-
-                        CrispyValue result = ht_get(&dict->content, key);
-                        PUSH(result);
+                        PUSH(dict_lookup(vm, dict, key_obj));
                         break;
                     }
                     case OBJ_LIST: {
                         ObjList *list = (ObjList *) obj;
 
-                        // Check if key is an integer
-                        if (key_val.type != NUMBER || floor(key_val.d_value) != key_val.d_value) {
+                        int64_t index;
+                        if (!to_index(key_val, &index)) {
                             fprintf(stderr, "Only integers can be used as indices for lists\n");
                             goto ERROR;
                         }
 
-                        int64_t index = (int64_t) key_val.d_value;
                         CrispyValue value;
                         bool success = list_get(list, index, &value);
 
@@ -871,35 +1303,117 @@ static InterpretResult run(Vm *vm) {
                         PUSH(value);
                         break;
                     }
+                    case OBJ_STRING:
+                    case OBJ_ROPE:
+                    case OBJ_SLICE: {
+                        int64_t index;
+                        if (!to_index(key_val, &index)) {
+                            fprintf(stderr, "Only integers can be used as indices for strings\n");
+                            goto ERROR;
+                        }
+
+                        CrispyValue value;
+                        bool success = string_get(vm, obj, index, &value);
+
+                        if (!success) {
+                            fprintf(stderr, "Index out of bounds\n");
+                            goto ERROR;
+                        }
+
+                        PUSH(value);
+                        break;
+                    }
                     default:
                         fprintf(stderr, "Invalid receiver for get operation\n");
                         goto ERROR;
                 }
 
-                break;
+                NEXT();
+            }
+            CASE(OP_GET_FIELD): {
+                ObjString *key = (ObjString *) AS_OBJ(READ_CONST_W());
+                InlineCache *cache = &caches[READ_SHORT()];
+                CrispyValue struct_val = POP();
+
+                if (!CHECK_OBJ_TYPE(struct_val, OBJ_DICT)) {
+                    if (!CHECK_OBJ(struct_val)) {
+                        fprintf(stderr, "Trying to retrieve an element from a primitive value\n");
+                    } else if (AS_OBJ(struct_val)->type == OBJ_LIST) {
+                        fprintf(stderr, "Only integers can be used as indices for lists\n");
+                    } else {
+                        fprintf(stderr, "Invalid receiver for get operation\n");
+                    }
+                    goto ERROR;
+                }
+
+                ObjDict *dict = (ObjDict *) AS_OBJ(struct_val);
+
+                if (dict->shape == cache->shape && dict->shape != NULL) {
+                    PUSH(dict->slots[cache->slot]);
+                } else {
+                    PUSH(dict_get_field(dict, key, cache));
+                }
+                NEXT();
+            }
+            CASE(OP_SET_FIELD): {
+                ObjString *key = (ObjString *) AS_OBJ(READ_CONST_W());
+                InlineCache *cache = &caches[READ_SHORT()];
+                CrispyValue value = POP();
+                CrispyValue structure = PEEK();
+
+                if (!CHECK_OBJ_TYPE(structure, OBJ_DICT)) {
+                    if (!CHECK_OBJ(structure)) {
+                        fprintf(stderr, "Trying to retrieve an element from a primitive value\n");
+                    } else if (AS_OBJ(structure)->type == OBJ_LIST) {
+                        fprintf(stderr, "Only integers can be used as indices for lists\n");
+                    } else {
+                        fprintf(stderr, "Invalid receiver for set operation\n");
+                    }
+                    goto ERROR;
+                }
+
+                ObjDict *dict = (ObjDict *) AS_OBJ(structure);
+                write_barrier(vm, (Object *) dict, create_object((Object *) key));
+                write_barrier(vm, (Object *) dict, value);
+
+                if (dict->shape == cache->shape && dict->shape != NULL) {
+                    if (cache->transition != NULL) {
+                        if (cache->slot >= dict->slot_cap) {
+                            size_t old_size = dict_memory(dict);
+                            dict_grow_slots(dict);
+                            track_memory(vm, old_size, dict_memory(dict));
+                        }
+                        dict->shape = cache->transition;
+                    }
+                    dict->slots[cache->slot] = value;
+                } else {
+                    size_t old_size = dict_memory(dict);
+                    dict_set_field(dict, key, value, cache, &vm->slabs);
+                    track_memory(vm, old_size, dict_memory(dict));
+                }
+                NEXT();
             }
-            case OP_STRUCT_PEEK: {
+            CASE(OP_STRUCT_PEEK): {
                 CrispyValue key_val = PEEK();
                 CrispyValue struct_val = sp[-2];
 
-                if (struct_val.type != OBJECT) {
+                if (!CHECK_OBJ(struct_val)) {
                     fprintf(stderr, "Trying to retrieve an element from a primitive value\n");
                     goto ERROR;
                 }
 
-                Object *obj = struct_val.o_value;
+                Object *obj = AS_OBJ(struct_val);
 
                 switch (obj->type) {
                     case OBJ_LIST: {
-                        ObjList *list = (ObjList *) struct_val.o_value;
+                        ObjList *list = (ObjList *) obj;
 
-                        // Check if key is an integer
-                        if (key_val.type != NUMBER || floor(key_val.d_value) != key_val.d_value) {
+                        int64_t index;
+                        if (!to_index(key_val, &index)) {
                             fprintf(stderr, "Only integers can be used as indices for lists\n");
                             goto ERROR;
                         }
 
-                        uint32_t index = (uint32_t) key_val.d_value;
                         CrispyValue value;
                         bool success = list_get(list, index, &value);
 
@@ -912,14 +1426,34 @@ static InterpretResult run(Vm *vm) {
                         break;
                     }
                     case OBJ_DICT: {
-                        ObjDict *dict = (ObjDict *) struct_val.o_value;
-                        ObjString *key_string = (ObjString *) key_val.o_value;
+                        ObjDict *dict = (ObjDict *) obj;
+
+                        if (!CHECK_STRING(key_val)) {
+                            fprintf(stderr, "Only strings can be used as indices for dictionaries\n");
+                            goto ERROR;
+                        }
+
+                        PUSH(dict_lookup(vm, dict, AS_OBJ(key_val)));
+                        break;
+                    }
+                    case OBJ_STRING:
+                    case OBJ_ROPE:
+                    case OBJ_SLICE: {
+                        int64_t index;
+                        if (!to_index(key_val, &index)) {
+                            fprintf(stderr, "Only integers can be used as indices for strings\n");
+                            goto ERROR;
+                        }
 
-                        HTItemKey key;
-                        key.key_obj_string = key_string;
+                        CrispyValue value;
+                        bool success = string_get(vm, obj, index, &value);
+
+                        if (!success) {
+                            fprintf(stderr, "Index out of bounds\n");
+                            goto ERROR;
+                        }
 
-                        CrispyValue result = ht_get(&dict->content, key);
-                        PUSH(result);
+                        PUSH(value);
                         break;
                     }
                     default:
@@ -927,9 +1461,12 @@ static InterpretResult run(Vm *vm) {
                         goto ERROR;
                 }
 
-                break;
+                NEXT();
             }
             default:
+#if THREADED_DISPATCH
+            UNKNOWN_INSTRUCTION:
+#endif
                 printf("Unknown instruction %d\n", instruction);
                 return INTERPRET_RUNTIME_ERROR;
         }
@@ -938,14 +1475,22 @@ static InterpretResult run(Vm *vm) {
     ERROR:
     return INTERPRET_RUNTIME_ERROR;
 
+#undef NEXT
+#undef CASE
+#undef DEBUG_INSTRUCTION
 #undef COND_JUMP
 #undef BINARY_OP
 #undef PEEK
 #undef PUSH
 #undef POP
 #undef READ_VAR
+#undef LOAD_FRAME
 #undef READ_CONST
 #undef READ_CONST_W
 #undef READ_SHORT
 #undef READ_BYTE
 }
+
+#if THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
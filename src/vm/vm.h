@@ -6,19 +6,23 @@
 #ifndef VM_H
 #define VM_H
 
-#define CURR_FRAME(vm_ptr)          ((vm_ptr)->frames.frame_pointers[(vm_ptr)->frame_count - 1])
-#define FRAME_AT(vm_ptr, offset)    ((vm_ptr)->frames.frame_pointers[(offset) - 1])
-#define PUSH_FRAME(vm_ptr, frame)   (frames_write_at(&(vm_ptr)->frames, (vm_ptr)->frame_count++, frame))
+#define CURR_FRAME(vm_ptr)          ((vm_ptr)->frames[(vm_ptr)->frame_count - 1].function)
+#define FRAME_AT(vm_ptr, offset)    (&(vm_ptr)->frames[(offset) - 1])
+#define PUSH_FRAME(vm_ptr, frame)   (push_frame((vm_ptr), (frame)))
 // same as POP_FRAME, but without the return value
 #define RM_FRAME(vm_ptr)            (--(vm_ptr)->frame_count)
-#define POP_FRAME(vm_ptr)           ((vm_ptr)->frames.frame_pointers[--(vm_ptr)->frame_count])
+#define POP_FRAME(vm_ptr)           ((vm_ptr)->frames[--(vm_ptr)->frame_count].function)
+
+#include <setjmp.h>
 
 #include "../util/common.h"
 #include "value.h"
 #include "dictionary.h"
+#include "shape.h"
 #include "../compiler/compiler.h"
 #include "options.h"
 #include "list.h"
+#include "slab.h"
 
 typedef enum {
     INTERPRET_OK,
@@ -33,27 +37,158 @@ typedef enum {
     VM_STATUS_NO_GC
 } VmStatus;
 
+/*
+ * A running call. The frames of all calls are stored in a single array inside the vm.
+ */
+typedef struct {
+    // the code, constants and inline caches of the called function
+    CallFrame *function;
+    // where the frame continues, once the function it called returns
+    uint8_t *ip;
+    // the variables. The main program keeps them in function->variables, lambdas in a window of the value stack,
+    // which starts with the arguments right above the called lambda
+    CrispyValue *slots;
+} Frame;
+
+typedef enum {
+    // no incremental collection is in progress
+    GC_PHASE_IDLE,
+    // the marks of the old generation are removed
+    GC_PHASE_CLEARING,
+    // the heap is marked in slices
+    GC_PHASE_MARKING,
+    // the old generation is swept a little on every allocation or by a background thread
+    GC_PHASE_SWEEPING
+} GcPhase;
+
+typedef struct {
+    uint64_t count;
+    uint64_t cap;
+    Object **objects;
+} ObjectArray;
+
+// the number of buckets of the pause time histogram
+#define GC_PAUSE_BUCKETS 8
+
 typedef struct {
-    uint32_t count;
-    uint32_t cap;
-    CallFrame **frame_pointers;
-} FrameArray;
+    uint64_t full_collections;
+    uint64_t minor_collections;
+    uint64_t compactions;
+
+    // all bytes, that have been allocated and freed (objects and the buffers they own)
+    size_t allocated;
+    size_t freed;
+    // the current size of the heap (only set by gc_stats)
+    size_t heap;
+
+    // the number of objects of every type, that survived the last full collection
+    uint64_t live_objects[OBJECT_TYPE_COUNT];
+
+    // pauses[i] counts the pauses, that were shorter than the limit of bucket i (see gc_pause_label)
+    uint64_t pauses[GC_PAUSE_BUCKETS];
+    // in nanoseconds
+    uint64_t total_pause;
+    uint64_t max_pause;
+} GcStats;
+
+// the worker threads of parallel marking (see memory.c)
+typedef struct gc_pool_t GcPool;
+
+// the thread of background sweeping (see memory.c)
+typedef struct gc_sweeper_t GcSweeper;
 
 typedef struct {
-    CrispyValue stack[STACK_MAX];
+    // STACK_MAX values
+    CrispyValue *stack;
     CrispyValue *sp;
 
-    FrameArray frames;
+    // FRAMES_MAX frames, the first one belongs to the main program
+    Frame *frames;
     uint32_t frame_count;
 
     Compiler compiler;
 
     HashTable strings;
 
+    // objects and hash table items are allocated from here
+    SlabAllocator slabs;
+
+    // the empty shape, every new dictionary starts with
+    Shape *root_shape;
+
+    // the interned strings of length 1 for every byte. They are never collected
+    ObjString *single_chars[256];
+
+    // the size of all objects including the buffers they own
     size_t allocated_mem;
+    // a full collection starts, once allocated_mem reaches this
     size_t max_alloc_mem;
+    // the old generation
     Object *first_object;
 
+    // all objects allocated since the last collection
+    Object *young_objects;
+    size_t young_mem;
+    // old objects, which might reference young objects
+    ObjectArray remembered;
+
+    // marked objects, whose references have not been marked yet
+    ObjectArray gray;
+
+    // the number of threads, that mark the heap during full stop the world collections
+    uint32_t gc_threads;
+    // created by the first parallel collection
+    GcPool *gc_pool;
+    // true while multiple threads are marking, so that mark bits have to be set atomically
+    bool parallel_marking;
+
+    // mark the heap in slices instead of stopping the program for a whole collection
+    bool incremental_gc;
+    // the number of objects, that are processed in a single slice
+    uint64_t gc_slice_budget;
+    GcPhase gc_phase;
+    // the next old object, whose mark has to be removed
+    Object *clear_cursor;
+
+    // old objects, that have not been swept since the last full collection
+    Object *unswept;
+    // free unreachable objects on a separate thread instead of during allocations
+    bool background_sweep;
+    // only exists while a background sweep is running
+    GcSweeper *sweeper;
+    // the heap size at the start of the last full collection
+    size_t collected_heap;
+    // the size of the objects, that survived the last full collection (only final after sweeping)
+    size_t live_mem;
+
+    // compact the heap, once a full collection leaves too much of the slab memory unused
+    bool compacting_gc;
+    // the heap is compacted at the next point, where the interpreter holds no object pointers outside of the vm
+    bool compaction_requested;
+
+    // the counters of gc_stats. The allocated bytes of the current cycle are only added at its end
+    GcStats stats;
+    // the survivors of the current full collection, which have been counted by the sweep so far
+    uint64_t surviving[OBJECT_TYPE_COUNT];
+
+    // the heap may grow by this factor between full collections
+    double heap_growth;
+    // the threshold for full collections never goes below min_heap or above max_heap (0 means no maximum)
+    size_t min_heap;
+    size_t max_heap;
+    // the hard limit for allocated_mem (SIZE_MAX if there is none)
+    size_t heap_limit;
+    // set, when a buffer grew beyond the limit. It is checked at the next safe point
+    bool heap_limit_exceeded;
+    // run jumps here, when the limit is exceeded. Only set while the program is running
+    jmp_buf *heap_limit_handler;
+    // the end of the last full collection (in nanoseconds)
+    uint64_t cycle_start;
+    // the time spent in the gc since the last full collection (in nanoseconds)
+    uint64_t cycle_gc_time;
+    // the number of bytes allocated since the last full collection
+    size_t cycle_allocated;
+
     // indicates if the program
     // is running in shell mode
     bool interactive;
@@ -63,11 +198,151 @@ typedef struct {
 } Vm;
 
 /**
- * Calls the garbage collector.
+ * Adds the change in size of the buffers owned by an object to the heap size.
+ * @param vm the current vm.
+ * @param old_size the size before the change.
+ * @param new_size the size after the change.
+ */
+static inline void track_memory(Vm *vm, size_t old_size, size_t new_size) {
+    // shrinking wraps around, which decreases the heap size
+    vm->allocated_mem += new_size - old_size;
+
+    if (new_size > old_size) {
+        vm->young_mem += new_size - old_size;
+        vm->cycle_allocated += new_size - old_size;
+
+        // the owner of the buffer might only be referenced by C variables, so it can't be collected here
+        if (vm->allocated_mem > vm->heap_limit) {
+            vm->heap_limit_exceeded = true;
+        }
+    }
+}
+
+/**
+ * Sets the parameters, that control when full collections happen.
+ * @param vm the current vm.
+ * @param heap_growth the factor, by which the heap may grow between full collections (greater than 1).
+ * @param min_heap the minimum threshold in bytes.
+ * @param max_heap the maximum threshold in bytes (0 means no maximum).
+ */
+void set_heap_limits(Vm *vm, double heap_growth, size_t min_heap, size_t max_heap);
+
+/**
+ * Sets the hard limit of the heap size. If a full collection can't bring the heap below the limit, the program
+ * stops with a runtime error instead of allocating more memory.
+ * @param vm the current vm.
+ * @param heap_limit the limit in bytes (0 means no limit).
+ */
+void set_heap_limit(Vm *vm, size_t heap_limit);
+
+/**
+ * Collects the heap, if it would exceed the hard limit after an allocation, and stops the program with a runtime
+ * error, if that does not help. Must only be called at points, where the gc may run.
+ * @param vm the current vm.
+ * @param size the size of the allocation in bytes (0 if the heap has already grown).
+ */
+void check_heap_limit(Vm *vm, size_t size);
+
+/**
+ * Calls the garbage collector (full collection of both generations).
  * @param vm the current vm.
  */
 void gc(Vm *vm);
 
+/**
+ * Collects only the young generation. Surviving objects are promoted to the old generation.
+ * @param vm the current vm.
+ */
+void minor_gc(Vm *vm);
+
+/**
+ * Sweeps a part of the old generation or checks if the background sweep has finished.
+ * @param vm the current vm.
+ */
+void sweep_step(Vm *vm);
+
+/**
+ * Sweeps the rest of the old generation or waits until the background sweep has finished.
+ * Does nothing if no sweep is in progress.
+ * @param vm the current vm.
+ */
+void finish_sweep(Vm *vm);
+
+/**
+ * Runs a complete full collection including the sweep. An unfinished incremental cycle is aborted first.
+ * @param vm the current vm.
+ */
+void full_gc(Vm *vm);
+
+/**
+ * Takes a snapshot of the gc statistics.
+ * @param vm the current vm.
+ * @param stats will be set to the current statistics.
+ */
+void gc_stats(Vm *vm, GcStats *stats);
+
+/**
+ * Returns the name of a bucket of the pause time histogram.
+ * @param bucket the index of the bucket.
+ * @return the name (e.g. "<1ms").
+ */
+const char *gc_pause_label(uint32_t bucket);
+
+/**
+ * Prints a summary of the gc statistics to stderr.
+ * @param vm the current vm.
+ */
+void print_gc_stats(Vm *vm);
+
+/**
+ * Performs a full collection and moves the objects out of mostly empty slabs, so that those can be released.
+ * Every reference to a moved object inside the vm is updated, so this must only be called, when no object
+ * pointers are held anywhere else (e.g. in local variables of the interpreter).
+ * @param vm the current vm.
+ */
+void compact_heap(Vm *vm);
+
+/**
+ * Stops the worker threads of parallel marking.
+ * @param vm the current vm.
+ */
+void stop_gc_threads(Vm *vm);
+
+/**
+ * Performs a single slice of an incremental collection. A new cycle is started if none is in progress.
+ * @param vm the current vm.
+ */
+void gc_step(Vm *vm);
+
+/**
+ * Adds an old object to the remembered set.
+ * @param vm the current vm.
+ * @param object the object.
+ */
+void remember_object(Vm *vm, Object *object);
+
+/**
+ * Handles a store of an unmarked object into a marked one (see write_barrier).
+ * @param vm the current vm.
+ * @param object the object, which was changed.
+ * @param value the stored object.
+ */
+void write_barrier_slow(Vm *vm, Object *object, Object *value);
+
+/**
+ * Has to be called whenever a value is stored inside an existing object.
+ * Minor collections don't trace old objects, so old objects pointing to young ones are remembered.
+ * While an incremental collection is marking, the stored object is marked instead.
+ * @param vm the current vm.
+ * @param object the object, which was changed.
+ * @param value the stored value.
+ */
+static inline void write_barrier(Vm *vm, Object *object, CrispyValue value) {
+    if (object->marked && CHECK_OBJ(value) && !AS_OBJ(value)->marked) {
+        write_barrier_slow(vm, object, AS_OBJ(value));
+    }
+}
+
 /**
  * Initialises a Vm.
  * @param vm the vm.
@@ -82,39 +357,43 @@ void vm_init(Vm *vm, bool interactive);
 void vm_free(Vm *vm);
 
 /**
- * Initialises a frame array (inside the vm).
- * @param frames the framearray.
+ * Pushes a frame for a function, whose variables are stored inside the function itself.
+ * The compiler uses this to emit the code of lambdas into their own call frame.
+ * @param vm the vm.
+ * @param function the function.
  */
-void frames_init(FrameArray *frames);
+void push_frame(Vm *vm, CallFrame *function);
 
 /**
- * Frees a frame array.
- * @param frames the framearray.
+ * Compiles the source code inside the scanner of the compiler in the passed vm.
+ * The generated bytecode is written inside the callframes of the vm.
+ * @param vm the vm.
+ * @return either 0 if the compilation was successful or INTERPRET_COMPILE_ERROR otherwise.
  */
-void frames_free(FrameArray *frames);
+int compile(Vm *vm);
 
 /**
- * Sets a frame in a framearray.
- * @param frame_arr the frame array.
- * @param index the index at which the frame will be inserted.
- * @param frame the frame.
+ * Computes the memory, that an object uses, including the buffers it owns.
+ * The flat buffer of a rope is not included, because it replaces the children of the rope.
+ * @param object the object.
+ * @return the size in bytes.
  */
-void frames_write_at(FrameArray *frame_arr, uint32_t index, CallFrame *frame);
+size_t object_size(Object *object);
 
 /**
- * Compiles the source code inside the scanner of the compiler in the passed vm.
- * The generated bytecode is written inside the callframes of the vm.
- * @param vm the vm.
- * @return either 0 if the compilation was successful or INTERPRET_COMPILE_ERROR otherwise.
+ * Computes the size of the block, that was allocated for an object (without the buffers it owns).
+ * @param object the object.
+ * @return the size in bytes.
  */
-int compile(Vm *vm);
+size_t allocation_size(Object *object);
 
 /**
- * Frees an object.
+ * Frees an object and returns its memory to the slab allocator of the vm.
+ * @param vm the vm, which allocated the object.
  * @param object the object.
- * @return the size of the freed object.
+ * @return the size of the freed object (see object_size).
  */
-size_t free_object(Object *object);
+size_t free_object(Vm *vm, Object *object);
 
 /**
  * Adds a constant to the current callframes constant pool. 
@@ -156,6 +435,86 @@ ObjString *new_empty_string(Vm *vm, size_t length);
  */
 ObjString *new_string(Vm *vm, const char *start, size_t length);
 
+/**
+ * Returns the characters of any string object (string, rope or slice).
+ * Ropes are flattened into a single buffer the first time this is called, the buffer is added to the heap size.
+ * Never triggers a garbage collection.
+ * @param vm the current VM.
+ * @param string the string object.
+ * @return a pointer to the (not null terminated) characters.
+ */
+const char *string_chars(Vm *vm, Object *string);
+
+/**
+ * Checks two values for equality.
+ * @param vm the current VM.
+ * @param first the first value.
+ * @param second the second value.
+ * @return true if both values are equal.
+ */
+bool values_equal(Vm *vm, CrispyValue first, CrispyValue second);
+
+int cmp_values(Vm *vm, CrispyValue first, CrispyValue second);
+
+int cmp_objects(Vm *vm, Object *first, Object *second);
+
+int cmp_strings(Vm *vm, Object *first, Object *second);
+
+/**
+ * Creates a rope, which represents the concatenation of two string objects without copying them.
+ * @param vm the current VM.
+ * @param left the first string object (string or rope).
+ * @param right the second string object (string or rope).
+ * @return a pointer to the created rope.
+ */
+ObjRope *new_rope(Vm *vm, Object *left, Object *right);
+
+/**
+ * Creates a substring. Long substrings are slices, which share the characters of the original string.
+ * @param vm the current VM.
+ * @param string the string object (string, rope or slice).
+ * @param start the index of the first char.
+ * @param length the length of the substring (start + length must not exceed the length of string).
+ * @return a pointer to the created string or slice.
+ */
+Object *new_substring(Vm *vm, Object *string, size_t start, size_t length);
+
+/**
+ * Returns the interned string with the given content, if there is one.
+ * @param vm the current VM.
+ * @param start a pointer to the first char of the string
+ * @param length the length of the string.
+ * @return a pointer to the interned string or NULL.
+ */
+ObjString *find_interned(Vm *vm, const char *start, size_t length);
+
+/**
+ * Interns the content of any string object (string, rope or slice), so that it can be used as a dictionary key.
+ * Never triggers a garbage collection.
+ * @param vm the current VM.
+ * @param string the string object.
+ * @return the interned string.
+ */
+ObjString *intern_string_obj(Vm *vm, Object *string);
+
+/**
+ * Returns the interned string with the given content. The string will only be created, if it is not interned yet.
+ * @param vm the current VM.
+ * @param start a pointer to the first char of the string
+ * @param length the length of the string.
+ * @return a pointer to the interned string.
+ */
+ObjString *new_interned_string(Vm *vm, const char *start, size_t length);
+
+/**
+ * Interns a string. If there already is an interned string with the same content, that string is returned instead.
+ * The intern table is weak, so interned strings are still collected by the gc once they are unreachable.
+ * @param vm the current VM.
+ * @param string the string that should be interned.
+ * @return the interned string.
+ */
+ObjString *intern_string(Vm *vm, ObjString *string);
+
 /**
  * Allocate a new native function Object.
  * @param vm the current VM.
@@ -168,12 +527,11 @@ ObjString *new_string(Vm *vm, const char *start, size_t length);
 ObjNativeFunc *new_native_func(Vm *vm, void *func_ptr, uint8_t num_params, bool system_func);
 
 /**
- * Creates a new dictionary.
+ * Creates a new (empty) dictionary with the root shape.
  * @param vm the current VM.
- * @param content the HashTable which represents the dictionary.
  * @return a pointer to the created dictionary.
  */
-ObjDict *new_dict(Vm *vm, HashTable content);
+ObjDict *new_dict(Vm *vm);
 
 /**
  * Creates a new list.
@@ -184,12 +542,15 @@ ObjDict *new_dict(Vm *vm, HashTable content);
 ObjList *new_list(Vm *vm, size_t size);
 
 /**
- * Clones a list.
+ * Creates a new list, which contains all elements of list followed by value.
+ * The new list shares its structure with list, so this only takes O(log32 n) if list was itself created by this function.
+ * Changing one of the lists afterwards does not affect the other.
  * @param vm the current vm.
  * @param list the original list.
- * @return the clone.
+ * @param value the appended value.
+ * @return the new list.
  */
-ObjList *clone_list(Vm *vm, ObjList *list);
+ObjList *new_appended_list(Vm *vm, ObjList *list, CrispyValue value);
 
 /**
  * Compiles and executes the source code.